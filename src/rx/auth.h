@@ -0,0 +1,63 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * auth.h
+ */
+
+#ifndef AUTH_H_
+#define AUTH_H_
+
+#include <stdint.h>
+
+#define AUTH_NONE	0	// packets are only checksummed
+#define AUTH_SPECK	1	// rolling counter and a truncated Speck64/128 CBC-MAC
+
+#ifndef AUTH
+#define AUTH	AUTH_NONE
+#endif
+
+#if (AUTH != AUTH_NONE)
+#define AUTH_MAC_SIZE	4	// MAC bytes on air
+#else
+#define AUTH_MAC_SIZE	0
+#endif
+#define AUTH_WINDOW		128	// counter steps a receiver follows without a resync
+
+/* key used when none has been programmed, change it for every installation */
+#ifndef AUTH_KEY
+#define AUTH_KEY	{ 0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0A, 0x0B, \
+					  0x10, 0x11, 0x12, 0x13, 0x18, 0x19, 0x1A, 0x1B }
+#endif
+
+/*
+ * With AUTH_SPECK every packet carries a MAC over a 32-bit counter that
+ * the transmitter never repeats. Only the low byte of the counter goes on
+ * air as SEQ, the receiver takes the rest from the last counter it
+ * accepted from the same remote and follows up to AUTH_WINDOW steps.
+ * CMD_PAIR carries the whole counter as payload, so a remote that was
+ * pressed out of range too often is resynced by holding its power key.
+ *
+ * The MAC is a CBC-MAC over the counter followed by ID_H ID_L LEN SEQ
+ * CMD DATA, zero padded to whole blocks, and truncated to AUTH_MAC_SIZE.
+ * LEN sits in the first block, which keeps messages of different length
+ * apart. A command with up to two payload bytes costs two blocks.
+ */
+void auth_init(const uint8_t *key);
+void auth_mac(uint8_t *mac, uint32_t ctr, const uint8_t *msg, uint8_t len);
+void speck_encrypt(uint8_t *block);	// 8 bytes in place, little endian words
+
+#endif /* AUTH_H_ */
@@ -0,0 +1,55 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * crc8.h
+ */
+
+#ifndef CRC8_H_
+#define CRC8_H_
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+/*
+ * Dallas/Maxim CRC-8 (polynomial x^8 + x^5 + x^4 + 1, reflected, initial
+ * value 0x00), identical to _crc_ibutton_update() from avr-libc.
+ *
+ * By default a 256 byte table in flash is used, which costs a single
+ * flash read per byte. Define CRC8_NIBBLE_TABLE to trade a few cycles for
+ * 224 bytes of flash by using a 16 byte table instead.
+ */
+#define CRC8_INIT	0x00
+
+#ifdef CRC8_NIBBLE_TABLE
+extern const uint8_t crc8_table[16] PROGMEM;
+
+static inline uint8_t crc8_update(uint8_t crc, uint8_t data) {
+	crc ^= data;
+	crc = (crc >> 4) ^ pgm_read_byte(&crc8_table[crc & 0x0F]);
+	crc = (crc >> 4) ^ pgm_read_byte(&crc8_table[crc & 0x0F]);
+	return crc;
+}
+#else
+extern const uint8_t crc8_table[256] PROGMEM;
+
+static inline uint8_t crc8_update(uint8_t crc, uint8_t data) {
+	return pgm_read_byte(&crc8_table[crc ^ data]);
+}
+#endif
+
+uint8_t crc8(const uint8_t *buf, uint8_t len);
+
+#endif /* CRC8_H_ */
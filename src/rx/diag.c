@@ -0,0 +1,255 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * diag.c
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+#include <util/atomic.h>
+
+#include "diag.h"
+#include "rfrx.h"
+#include "speed.h"
+#include "utils.h"
+
+#if DIAG
+
+#define DIAG_PORT		PORTD
+#define DIAG_PIN		PD4		// software UART output
+#define DIAG_JMP_PORT	PORTD
+#define DIAG_JMP_PIN	PD7		// jumper to ground selects the hardware UART
+
+#define DIAG_BUFFER_MASK	(DIAG_BUFFER_SIZE - 1)
+#define DIAG_LINE_MAX	78		// longest record including CR LF
+
+#if (DIAG_BUFFER_SIZE & DIAG_BUFFER_MASK)
+#error DIAG buffer size is not a power of 2
+#endif
+
+#if (DIAG_BUFFER_SIZE <= DIAG_LINE_MAX || DIAG_BUFFER_SIZE > 256)
+#error "DIAG_BUFFER_SIZE must hold one record and fit an 8-bit index"
+#endif
+
+/* record period in rx_tick() counts */
+#define DIAG_TICKS		((DIAG_PERIOD_MS * (F_CPU / 1000UL) + RX_TICK_CYCLES / 2) / RX_TICK_CYCLES)
+
+#if (DIAG_TICKS == 0 || DIAG_TICKS > 0x7FFF)
+#error "DIAG_PERIOD_MS out of range"
+#endif
+
+/* timer 1 already runs at clk/1 for the input capture, otherwise clk/8 */
+#if (RX_INPUT == RX_INPUT_ICP)
+#define DIAG_PRESCALE	1UL
+#else
+#define DIAG_PRESCALE	8UL
+#endif
+
+/* one bit of the software UART in timer ticks */
+#define DIAG_BIT		((F_CPU + DIAG_BAUD * DIAG_PRESCALE / 2) / (DIAG_BAUD * DIAG_PRESCALE))
+#define DIAG_BAUD_REAL	(F_CPU / (DIAG_PRESCALE * DIAG_BIT))
+
+#if ((SPEED_OUTPUT == SPEED_OUTPUT_TRIAC && DIAG_BIT > 256) || (DIAG_BAUD_REAL * 1000 > DIAG_BAUD * 1020UL) || (DIAG_BAUD_REAL * 1000 < DIAG_BAUD * 980UL))
+#error "DIAG_BAUD cannot be generated from F_CPU"
+#endif
+
+#if (SPEED_OUTPUT == SPEED_OUTPUT_TRIAC)
+/* timer 2 is left unused by the triac output, CTC mode */
+#define DIAG_TIMER_vect		TIMER2_COMP_vect
+#define diag_timer_start()	do { TCNT2 = 0; OCR2 = DIAG_BIT - 1; \
+		TIFR = (1 << OCF2); TCCR2 = (1 << WGM21) | (1 << CS21); \
+		sbit(TIMSK, OCIE2); } while (0)
+#define diag_timer_stop()	do { cbit(TIMSK, OCIE2); TCCR2 = 0; } while (0)
+#define diag_timer_next()
+#elif (RX_INPUT == RX_INPUT_ICP)
+/* timer 1 keeps running for the input capture, channel B steps along */
+#define DIAG_TIMER_vect		TIMER1_COMPB_vect
+#define diag_timer_start()	do { OCR1B = TCNT1 + DIAG_BIT; TIFR = (1 << OCF1B); \
+		sbit(TIMSK, OCIE1B); } while (0)
+#define diag_timer_stop()	cbit(TIMSK, OCIE1B)
+#define diag_timer_next()	OCR1B += DIAG_BIT
+#else
+/* timer 1 is left unused by the PWM output, channel B steps along */
+#define DIAG_TIMER_vect		TIMER1_COMPB_vect
+#define diag_timer_start()	do { OCR1B = TCNT1 + DIAG_BIT; TIFR = (1 << OCF1B); \
+		TCCR1B = (1 << CS11); sbit(TIMSK, OCIE1B); } while (0)
+#define diag_timer_stop()	do { cbit(TIMSK, OCIE1B); TCCR1B = 0; } while (0)
+#define diag_timer_next()	OCR1B += DIAG_BIT
+#endif
+
+static const char diag_header[] PROGMEM =
+		"time,frames,crc,crc_pm,voted,repeats,drops,mac,fe,dor,resync,last,power,speed\r\n";
+
+static volatile uint8_t diag_buf[DIAG_BUFFER_SIZE];
+static volatile uint8_t diag_head = 0;
+static volatile uint8_t diag_tail = 0;
+static volatile uint8_t diag_bits = 0;	// bits left of the byte being shifted out
+static volatile uint8_t diag_shift;
+static volatile uint8_t diag_active = 0;	// software UART timer is running
+static uint8_t diag_hw;			// records go to the hardware UART
+static uint16_t diag_last;		// rx_time() of the last record
+static uint16_t diag_frames;	// counters at the last record
+static uint16_t diag_crc;
+
+/* start bit, 8 data bits and stop bit, one per interrupt */
+ISR(DIAG_TIMER_vect) {
+	uint8_t tmptail;
+
+	diag_timer_next();
+	if (diag_bits > 1) {
+		if (diag_shift & 1) {
+			sbit(DIAG_PORT, DIAG_PIN);
+		} else {
+			cbit(DIAG_PORT, DIAG_PIN);
+		}
+		diag_shift >>= 1;
+		--diag_bits;
+	} else if (diag_bits) {
+		sbit(DIAG_PORT, DIAG_PIN);	// stop bit
+		diag_bits = 0;
+	} else if (diag_head != diag_tail) {
+		tmptail = (diag_tail + 1) & DIAG_BUFFER_MASK;
+		diag_tail = tmptail;
+		diag_shift = diag_buf[tmptail];
+		cbit(DIAG_PORT, DIAG_PIN);	// start bit
+		diag_bits = 9;
+	} else {
+		diag_timer_stop();
+		diag_active = 0;
+	}
+}
+
+ISR(USART_UDRE_vect) {
+	uint8_t tmptail;
+
+	if (diag_head != diag_tail) {
+		tmptail = (diag_tail + 1) & DIAG_BUFFER_MASK;
+		diag_tail = tmptail;
+		UDR = diag_buf[tmptail];
+	} else {
+		cbit(UCSRB, UDRIE);	// buffer empty
+	}
+}
+
+/* never waits, the caller checks for room first */
+static void diag_putc(uint8_t data) {
+	uint8_t tmphead = (diag_head + 1) & DIAG_BUFFER_MASK;
+
+	if (tmphead != diag_tail) {
+		diag_buf[tmphead] = data;
+		diag_head = tmphead;
+	}
+}
+
+static void diag_puts_p(const char *progmem_s) {
+	char c;
+
+	while ((c = pgm_read_byte(progmem_s++))) {
+		diag_putc(c);
+	}
+}
+
+/* decimal without leading zeros, then a comma */
+static void diag_putu(uint16_t v) {
+	char digits[5];
+	uint8_t n = 0;
+
+	do {
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (n) {
+		diag_putc(digits[--n]);
+	}
+	diag_putc(',');
+}
+
+static uint8_t diag_free(void) {
+	return (diag_tail - diag_head - 1) & DIAG_BUFFER_MASK;
+}
+
+/* hand the buffer to whichever port is in use */
+static void diag_kick(void) {
+	if (diag_hw) {
+		sbit(UCSRB, UDRIE);
+		return;
+	}
+	/* also called from init() before interrupts are enabled */
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (!diag_active) {
+			diag_active = 1;
+			diag_timer_start();
+		}
+	}
+}
+
+void diag_init(void) {
+	/* the jumper is only read at reset */
+	cbit(ddr(DIAG_JMP_PORT), DIAG_JMP_PIN);
+	sbit(DIAG_JMP_PORT, DIAG_JMP_PIN);	// enable pullup
+	_delay_us(10);
+	diag_hw = bit_is_clr(pin(DIAG_JMP_PORT), DIAG_JMP_PIN);
+
+	if (diag_hw) {
+		sbit(UCSRB, TXEN);	// same baud rate as the receiver
+	} else {
+		sbit(DIAG_PORT, DIAG_PIN);	// idles at mark
+		sbit(ddr(DIAG_PORT), DIAG_PIN);
+	}
+
+	diag_last = rx_time();
+	diag_puts_p(diag_header);
+	diag_kick();
+}
+
+void diag_poll(uint8_t state, uint8_t speed) {
+	struct rx_stats s;
+	uint16_t now = rx_time();
+	uint16_t frames, crc;
+
+	if ((uint16_t) (now - diag_last) < DIAG_TICKS || diag_free() < DIAG_LINE_MAX) {
+		return;
+	}
+	diag_last = now;
+
+	rx_stats(&s);
+	frames = s.frames - diag_frames;
+	crc = s.crc - diag_crc;
+	diag_frames = s.frames;
+	diag_crc = s.crc;
+
+	diag_putu(now);
+	diag_putu(s.frames);
+	diag_putu(s.crc);
+	diag_putu(crc ? (uint32_t) crc * 1000 / ((uint32_t) frames + crc) : 0);
+	diag_putu(s.voted);
+	diag_putu(s.repeats);
+	diag_putu(s.drops);
+	diag_putu(s.mac);
+	diag_putu(s.fe);
+	diag_putu(s.dor);
+	diag_putu(s.resync);
+	diag_putu(s.last);
+	diag_putu(state);
+	diag_putc('0' + speed);
+	diag_putc('\r');
+	diag_putc('\n');
+	diag_kick();
+}
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * diag.h
+ */
+
+#ifndef DIAG_H_
+#define DIAG_H_
+
+#include <stdint.h>
+
+/* build with DIAG=1 for link quality records on a debug port */
+#ifndef DIAG
+#define DIAG	0
+#endif
+
+#ifndef DIAG_PERIOD_MS
+#define DIAG_PERIOD_MS	1000	// one record per period at most
+#endif
+#ifndef DIAG_BAUD
+#define DIAG_BAUD		2400	// software UART, the hardware one runs at BAUDRATE
+#endif
+
+/* size of the circular transmit buffer, must be power of 2 */
+#ifndef DIAG_BUFFER_SIZE
+#define DIAG_BUFFER_SIZE	128
+#endif
+
+/*
+ * Records are CSV lines, preceded by a header line after reset:
+ *
+ *   time,frames,crc,crc_pm,voted,repeats,drops,mac,fe,dor,resync,last,power,speed
+ *
+ * time and last are rx_time() counts, crc_pm is the share of bad checksums
+ * since the previous record in permille, the other counters are those of
+ * struct rx_stats. They go out 8N1 on PD4 from a software UART, or on TXD
+ * of the hardware UART if PD7 is jumpered to ground at reset. The software
+ * UART takes timer 1 channel B, or timer 2 with SPEED_OUTPUT_TRIAC.
+ *
+ * A record is only started if it fits into the buffer, the CPU never waits
+ * for the port, and a slow port only means fewer records.
+ */
+void diag_init(void);
+void diag_poll(uint8_t state, uint8_t speed);	// call from the main loop
+
+#endif /* DIAG_H_ */
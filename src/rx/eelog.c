@@ -0,0 +1,194 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * eelog.c
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+
+#include "eelog.h"
+#include "crc8.h"
+#include "utils.h"
+
+#define EELOG_SIZE	(4 + EELOG_EXTRA)	// bytes per record
+#define EELOG_MAGIC	0xA5	// folded into the checksum, rejects all-zero records
+
+#if (EELOG_RECORDS > 127)
+#error "EELOG_RECORDS too large for an 8-bit sequence number"
+#endif
+
+static uint8_t EEMEM eelog[EELOG_RECORDS * EELOG_SIZE];
+
+static uint8_t log_next;	// slot the next record goes to
+static uint8_t log_seq;		// sequence number of the newest record
+static uint8_t log_state;	// contents of the newest record
+static uint8_t log_speed;
+#if EELOG_EXTRA
+static uint8_t log_extra[EELOG_EXTRA];
+#endif
+static uint8_t log_valid;	// the log holds at least one record
+static uint8_t log_open;	// eelog_open() since the newest record
+
+/* record being written by the EEPROM ready interrupt */
+static uint8_t ee_rec[EELOG_SIZE];
+static const uint8_t *ee_src;
+static uint8_t *ee_dst;
+static volatile uint8_t ee_left;
+
+static uint8_t eelog_crc8(const uint8_t *rec) {
+	return crc8(rec, EELOG_SIZE - 1) ^ EELOG_MAGIC;
+}
+
+/* one byte per interrupt, the CPU never waits for the 8.5 ms write */
+ISR(EE_RDY_vect) {
+	if (!ee_left) {
+		cbit(EECR, EERIE);
+		return;
+	}
+	EEAR = (uintptr_t) ee_dst++;
+	EEDR = *ee_src++;
+	--ee_left;
+	sbit(EECR, EEMWE);
+	sbit(EECR, EEWE);
+}
+
+static void eelog_start(uint8_t n) {
+	ee_src = ee_rec;
+	ee_dst = &eelog[log_next * EELOG_SIZE];
+	ee_left = n;
+	sbit(EECR, EERIE);	// fires as soon as the EEPROM is ready
+}
+
+uint8_t eelog_read(uint8_t *state, uint8_t *speed, uint8_t *extra) {
+	uint8_t rec[EELOG_SIZE];
+	uint8_t i, open;
+
+	/* the newest valid record wins, sequence numbers are compared modulo
+	 * 256 which works as long as the ring holds less than 128 records */
+	log_valid = 0;
+	log_next = 0;
+	for (i = 0; i < EELOG_RECORDS; ++i) {
+		eeprom_read_block(rec, &eelog[i * EELOG_SIZE], EELOG_SIZE);
+		if (rec[EELOG_SIZE - 1] != eelog_crc8(rec)) {
+			continue;
+		}
+		if (!log_valid || (int8_t) (rec[0] - log_seq) > 0) {
+			log_valid = 1;
+			log_seq = rec[0];
+			log_state = rec[1];
+			log_speed = rec[2];
+#if EELOG_EXTRA
+			for (open = 0; open < EELOG_EXTRA; ++open) {
+				log_extra[open] = rec[3 + open];
+			}
+#endif
+			log_next = (i + 1) % EELOG_RECORDS;
+		}
+	}
+
+	/* the slot after the newest record starts with the next sequence
+	 * number once the log was opened, or a record was half written there.
+	 * An erased byte can look the same, that costs a needless skip.
+	 * log_open stays clear, the log is opened afresh after the next record. */
+	log_open = 0;
+	open = eeprom_read_byte(&eelog[log_next * EELOG_SIZE]);
+	open = open == (uint8_t) (log_valid ? log_seq + 1 : 0) ? EELOG_OPEN : 0;
+
+	if (!log_valid) {
+		return open;
+	}
+	*state = log_state;
+	*speed = log_speed;
+#if EELOG_EXTRA
+	for (i = 0; i < EELOG_EXTRA; ++i) {
+		extra[i] = log_extra[i];
+	}
+#else
+	(void) extra;
+#endif
+	return EELOG_FOUND | open;
+}
+
+uint8_t eelog_write(uint8_t state, uint8_t speed, const uint8_t *extra) {
+	uint8_t same;
+#if EELOG_EXTRA
+	uint8_t i;
+#endif
+
+	if (ee_left) {
+		return 0;
+	}
+
+	/* nothing to do if the newest record already says so, unless the log
+	 * was opened, a record is what closes it */
+	same = log_valid && !log_open && state == log_state && speed == log_speed;
+#if EELOG_EXTRA
+	for (i = 0; same && i < EELOG_EXTRA; ++i) {
+		same = extra[i] == log_extra[i];
+	}
+#endif
+	if (same) {
+		return 1;
+	}
+
+	log_seq = log_valid ? log_seq + 1 : 0;
+	log_state = state;
+	log_speed = speed;
+	log_valid = 1;
+	log_open = 0;
+
+	ee_rec[0] = log_seq;
+	ee_rec[1] = state;
+	ee_rec[2] = speed;
+#if EELOG_EXTRA
+	for (i = 0; i < EELOG_EXTRA; ++i) {
+		ee_rec[3 + i] = log_extra[i] = extra[i];
+	}
+#else
+	(void) extra;
+#endif
+	ee_rec[EELOG_SIZE - 1] = eelog_crc8(ee_rec);
+	eelog_start(EELOG_SIZE);
+	log_next = (log_next + 1) % EELOG_RECORDS;
+
+	return 1;
+}
+
+/* the SEQ of the next record marks the log open, the record itself
+ * overwrites it with the same byte */
+uint8_t eelog_open(void) {
+	if (ee_left) {
+		return 0;
+	}
+	if (!log_open) {
+		log_open = 1;
+		ee_rec[0] = log_valid ? log_seq + 1 : 0;
+		eelog_start(1);
+	}
+	return 1;
+}
+
+uint8_t eelog_opened(void) {
+	return log_open && !eelog_busy();
+}
+
+/* the last byte is still being written after ee_left has run out, an
+ * eeprom_*() call made now would wait for it */
+uint8_t eelog_busy(void) {
+	return ee_left || bit_is_set(EECR, EEWE);
+}
@@ -0,0 +1,65 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * eelog.h
+ */
+
+#ifndef EELOG_H_
+#define EELOG_H_
+
+#include <stdint.h>
+
+#include "rfrx.h"
+
+/* bytes kept in every record besides state and speed, the rolling
+ * counters with AUTH_SPECK */
+#define EELOG_EXTRA		RX_SAVE_SIZE
+
+/* records in the ring, each one is written once per EELOG_RECORDS commits */
+#ifndef EELOG_RECORDS
+#if EELOG_EXTRA
+#define EELOG_RECORDS	10
+#else
+#define EELOG_RECORDS	64
+#endif
+#endif
+
+/* what eelog_read() found */
+#define EELOG_FOUND		0x01	// a record, state and speed are valid
+#define EELOG_OPEN		0x02	// eelog_open() was called after it
+
+/*
+ * State and speed are appended to a ring of records in EEPROM instead of
+ * being overwritten in place, which spreads the wear over the whole ring.
+ * A record is laid out as
+ *
+ *   SEQ STATE SPEED EXTRA[EELOG_EXTRA] CRC8
+ *
+ * where SEQ counts up by one per record and CRC8 covers the bytes before
+ * it, so erased, zeroed and half written records are ignored.
+ *
+ * eelog_open() writes only the SEQ of the next record, a single byte.
+ * eelog_read() reports it as EELOG_OPEN, and the same when the power went
+ * while that record was being written. The receiver opens the log before
+ * it acts on the first command of a burst, see rx_restore().
+ */
+uint8_t eelog_read(uint8_t *state, uint8_t *speed, uint8_t *extra);
+uint8_t eelog_write(uint8_t state, uint8_t speed, const uint8_t *extra);	// 0 if still busy
+uint8_t eelog_open(void);	// 0 if still busy
+uint8_t eelog_opened(void);	// the open mark is in EEPROM, no record written since
+uint8_t eelog_busy(void);
+
+#endif /* EELOG_H_ */
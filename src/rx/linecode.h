@@ -0,0 +1,72 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * linecode.h
+ */
+
+#ifndef LINECODE_H_
+#define LINECODE_H_
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#define LINE_CODE_NONE	0	// bytes go on air as they are
+#define LINE_CODE_4B8B	1	// every nibble becomes one DC-balanced symbol
+#define LINE_CODE_HAMMING	2	// every nibble becomes one extended Hamming(8,4) codeword
+
+#ifndef LINE_CODE
+#define LINE_CODE	LINE_CODE_NONE
+#endif
+
+#define LC_INVALID	0xFF	// returned by lc_decode() for a corrupted symbol
+
+/*
+ * The 4b8b symbols have four ones and four zeros and, framed by the UART
+ * start and stop bits, never hold the line at one level for more than two
+ * bit times, which keeps the AGC of OOK receivers steady. 6-bit symbols
+ * would not fit 8N1 frames. Any single bit error changes the weight of a
+ * symbol and is caught by the decoder. HEAD and SIGN are no valid symbols,
+ * so a decoder waiting for one resynchronizes on a new packet.
+ *
+ * The Hamming(8,4) codewords are those of the extended code XOR 0x09.
+ * They lie at least four bits apart, so lc_decode() corrects any single
+ * bit error in a symbol and catches any double one. The mask keeps 0x00
+ * and 0xFF out of the code and the runs within a framed symbol at five
+ * bits or less. Like every even-weight byte that is not a codeword,
+ * HEAD, SIGN and 0x55 decode as invalid. Correction only reaches the
+ * bytes after SIGN. One coded copy takes about the air time of two
+ * plain ones.
+ */
+#if (LINE_CODE == LINE_CODE_4B8B || LINE_CODE == LINE_CODE_HAMMING)
+#define LC_SYMBOLS	2		// UART bytes per coded byte
+#define LC_SYNC		0x55	// preamble byte, alternating bits
+#else
+#define LC_SYMBOLS	1
+#define LC_SYNC		0xFF	// preamble byte, idle line
+#endif
+
+extern const uint8_t lc_enc_table[16] PROGMEM;
+extern const uint8_t lc_dec_table[256] PROGMEM;
+
+static inline uint8_t lc_encode(uint8_t nibble) {
+	return pgm_read_byte(&lc_enc_table[nibble]);
+}
+
+static inline uint8_t lc_decode(uint8_t symbol) {
+	return pgm_read_byte(&lc_dec_table[symbol]);
+}
+
+#endif /* LINECODE_H_ */
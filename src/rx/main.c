@@ -26,49 +26,240 @@
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
 #include <util/delay.h>
-#include <util/atomic.h>
 
 #include "rfrx.h"
+#include "eelog.h"
+#include "speed.h"
+#include "diag.h"
 #include "utils.h"
 
+/* with AUTH_SPECK the rolling counters go into the log with state and
+ * speed, and a command is only acted on while the log is open, see
+ * rx_restore(). Opening it writes a single byte, the first command of a
+ * burst waits about 8.5 ms for it. */
+#if (AUTH != AUTH_NONE)
+#define burst_open()	eelog_opened()
+#define save_due()		rx_save_due()
+#else
+#define burst_open()	1
+#define save_due()		0
+#endif
+
+/* state is saved once no command has arrived for this long */
+#define SAVE_DELAY_MS	2000
+#define SAVE_TICKS		((SAVE_DELAY_MS * (F_CPU / 1000UL)) / RX_TICK_CYCLES)
+
+#if (SAVE_TICKS > 255 || SAVE_TICKS == 0)
+#error "SAVE_DELAY_MS out of range for timer 0"
+#endif
+
+/* remotes can be paired for this long after power-up */
+#define PAIR_WINDOW_MS	30000
+#define PAIR_TICKS		((PAIR_WINDOW_MS * (F_CPU / 1000UL)) / RX_TICK_CYCLES)
+
+#if (PAIR_TICKS > 0xFFFF)
+#error "PAIR_WINDOW_MS too long for timer 0"
+#endif
+
 uint8_t EEMEM state = 0;	// default state is OFF
 uint8_t EEMEM speed = 0;	// default speed is 1
 
 volatile static uint8_t cur_state = 0;
 volatile static uint8_t cur_speed = 0;
+volatile static uint8_t save_ticks = 0;	// overflows left before saving
+volatile static uint16_t pair_ticks = 0;	// overflows left in the pairing window
+volatile static uint8_t pair_open = 0;
+
+/* timer 0 runs all the time, the packet time stamps, the vote and DIAG
+ * need a clock that does not stop between bursts. Its overflow wakes the
+ * CPU from idle about 61 times a second at 1 MHz. */
+ISR(TIMER0_OVF_vect) {
+	rx_tick();
+	if (save_ticks) {
+		--save_ticks;
+	}
+	if (pair_ticks && !--pair_ticks) {
+		pair_open = 0;
+		rx_pair_open(0);
+	}
+}
+
+/* (re)start the save countdown, called after every command */
+static void save_later(void) {
+	save_ticks = SAVE_TICKS;
+}
+
+/* write state, speed and the counters to the log, closing it */
+static uint8_t save(void) {
+#if (AUTH != AUTH_NONE)
+	uint8_t ctr[EELOG_EXTRA];
+
+	if (eelog_busy()) {
+		return 0;
+	}
+	rx_snapshot(ctr);
+	return eelog_write(cur_state, cur_speed, ctr);
+#else
+	return eelog_write(cur_state, cur_speed, 0);
+#endif
+}
+
+/* returns 1 if the log has to be written before anything else */
+uint8_t init(void) {
+	uint8_t st, sp;
+	uint8_t found;
+#if (AUTH != AUTH_NONE)
+	uint8_t ctr[EELOG_EXTRA];
+#else
+	uint8_t *ctr = 0;	// the log holds nothing else
+#endif
 
-void init(void) {
 	rx_init();			// initialize receiver
 
-	eeprom_busy_wait();
-	cur_state = eeprom_read_byte(&state);	// restore state
-	eeprom_busy_wait();
-	cur_speed = eeprom_read_byte(&speed);	// restore speed
+	/* restore the newest saved state, or the defaults if none was saved */
+	found = eelog_read(&st, &sp, ctr);
+	if (found & EELOG_FOUND) {
+		cur_state = st;
+		cur_speed = sp > SPEED_MAX ? SPEED_MAX : sp;
+	} else {
+		eeprom_busy_wait();
+		cur_state = eeprom_read_byte(&state);	// restore state
+		eeprom_busy_wait();
+		cur_speed = eeprom_read_byte(&speed);	// restore speed
+	}
+#if (AUTH != AUTH_NONE)
+	/* the power went in the middle of a burst, the counters skip ahead
+	 * and are saved that way before any command is acted on */
+	rx_restore((found & EELOG_FOUND) ? ctr : 0, found & EELOG_OPEN);
+#endif
+
+	TIMSK |= (1 << TOIE0);
+
+	/* hold the power key on a remote to pair it within the window */
+	pair_ticks = PAIR_TICKS;
+	pair_open = 1;
+	rx_pair_open(1);
+	TCCR0 = (1 << CS01) | (1 << CS00);	// clk/64
+
+	speed_init();
+	speed_set(cur_state, cur_speed);	// soft-starts to the restored speed
+
+#if DIAG
+	diag_init();
+#endif
+#if (AUTH != AUTH_NONE)
+	return (found & EELOG_OPEN) != 0;
+#else
+	return 0;
+#endif
 }
 
 int main(void) {
-	init();
+	struct rx_packet pkt;
+	uint8_t cmd;
+	uint8_t pending;		// state changed since it was last saved
+	uint8_t pair = 0;		// pair_id waits for the EEPROM
+	uint16_t pair_id = 0;
+
+	pending = init();
+	set_sleep_mode(SLEEP_MODE_IDLE);	// the UART needs the I/O clock
 	sei();	// enable interrupts globally
 
 	while (1) {
-		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-			uint8_t cmd = rx_getcmd();
-			switch (cmd) {
-			case CMD_PWR:
+		/* commit to EEPROM once the commands have stopped, or at once
+		 * when a counter nears its limit. eelog_write() returns at once and
+		 * the EEPROM interrupt does the writing. */
+		if (((pending && !save_ticks) || save_due()) && !eelog_busy()) {
+			if (save()) {
+				pending = 0;
+			}
+		}
+		if (pair && !eelog_busy()) {
+			rx_pair(pair_id);
+			pair = 0;
+		}
+#if (AUTH != AUTH_NONE)
+		/* a record closes the log again, even if the packet is refused */
+		if (rx_pending() && !burst_open() && !eelog_busy() && eelog_open()) {
+			save_later();
+			pending = 1;
+		}
+#endif
+#if DIAG
+		diag_poll(cur_state, cur_speed);
+#endif
+		rx_poll();
+
+		/* sleep until the receive interrupt has queued a packet, testing
+		 * with interrupts off so a packet cannot slip in before sleep_cpu() */
+		cli();
+		if ((!rx_pending() || (!burst_open() && eelog_busy())) && !rx_bytes()
+				&& (((!pending || save_ticks) && !save_due()) || eelog_busy())
+				&& (!pair || eelog_busy())) {
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+		}
+		sei();
+
+		if (!burst_open()) {
+			continue;
+		}
+		cmd = rx_getcmd(&pkt);
+		if (!cmd) {
+			continue;
+		}
+		if (cmd == CMD_PAIR) {
+			/* only let in while the window is open, a paired remote
+			 * asking again does no harm */
+			if (pair_open) {
+				pair_id = pkt.id;
+				pair = 1;
+			}
+			continue;
+		}
+		save_later();
+		pending = 1;
+
+		switch (cmd) {
+		case CMD_PWR:
+			if (pkt.len >= 1) {
+				cur_state = pkt.data[0] & 1;
+			} else {
 				tbit(cur_state, 0);
-				break;
-			case CMD_INC:
-				if (cur_speed != 9) {
-					++cur_speed;
-				}
-				break;
-			case CMD_DEC:
-				if (cur_speed != 0) {
-					--cur_speed;
-				}
-				break;
 			}
+			break;
+		case CMD_INC:
+			if (cur_speed != SPEED_MAX) {
+				++cur_speed;
+			}
+			break;
+		case CMD_DEC:
+			if (cur_speed != 0) {
+				--cur_speed;
+			}
+			break;
+		case CMD_DELTA:
+			if (pkt.len >= 1) {
+				int16_t speed = cur_speed + (int8_t) pkt.data[0];
+				cur_speed = speed < 0 ? 0 : (speed > SPEED_MAX ? SPEED_MAX : speed);
+			}
+			break;
+		case CMD_SPEED:
+			if (pkt.len >= 1 && pkt.data[0] <= SPEED_MAX) {
+				cur_speed = pkt.data[0];
+			}
+			break;
+		case CMD_STATE:
+			/* absolute state, applying it twice does no harm */
+			if (pkt.len >= 2 && pkt.data[1] <= SPEED_MAX) {
+				cur_state = pkt.data[0] & 1;
+				cur_speed = pkt.data[1];
+			}
+			break;
 		}
+		speed_set(cur_state, cur_speed);
 	}
 	return 0;
 }
@@ -23,126 +23,808 @@
 #include <stdio.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/eeprom.h>
 #include <util/delay.h>
 #include <util/atomic.h>
 
 #include "rfrx.h"
+#include "crc8.h"
+#include "linecode.h"
+#include "auth.h"
+#include "utils.h"
 
-#define PACKET_SIZE		4
-#define RX_BUFFER_SIZE	2
 #define RX_BUFFER_MASK	(RX_BUFFER_SIZE - 1)
 
 /* size of the circular transmit buffer, must be power of 2 */
 #define TX_BUFFER_SIZE	8
 #define TX_BUFFER_MASK	(TX_BUFFER_SIZE - 1)
 
+/* packets this far behind the last accepted sequence number are stale */
+#define RX_SEQ_WINDOW	16
+
+#if (RX_BUFFER_SIZE & RX_BUFFER_MASK)
+#error RX buffer size is not a power of 2
+#endif
+
+#if (RX_PAIR_MAX > 7)
+#error "RX_PAIR_MAX too large for the rx_seen bit mask"
+#endif
+
 /* test if the size of the circular buffers fits into SRAM */
-#if ((PACKET_SIZE+TX_BUFFER_SIZE) >= (RAMEND-0x60 ))
+#if ((RX_BUFFER_SIZE*(PACKET_DATA_MAX+AUTH_MAC_SIZE+7)+TX_BUFFER_SIZE) >= (RAMEND-0x60 ))
 #error "size of buffers larger than size of SRAM"
 #endif
 
-static volatile uint8_t packet[PACKET_SIZE];
-static volatile uint8_t rx_buf[RX_BUFFER_SIZE];
+/* bytes from ID_H up to CRC8, as kept for the vote */
+#define RX_FRAME_MAX	(PACKET_DATA_MAX + AUTH_MAC_SIZE + 6)
+#define RX_VOTE_TICKS	((RX_VOTE_MS * (F_CPU / 1000UL)) / RX_TICK_CYCLES)
+
+#if (RX_INPUT == RX_INPUT_ICP)
+#define ICP_PORT		PORTB
+#define ICP_PIN			PB0		// ICP1
+
+/* one bit in timer 1 ticks at clk/1, tracked within an eighth of it */
+#define ICP_BIT			((F_CPU + BAUDRATE / 2) / BAUDRATE)
+#define ICP_BIT_MIN		(ICP_BIT - ICP_BIT / 8)
+#define ICP_BIT_MAX		(ICP_BIT + ICP_BIT / 8)
+
+/* bytes waiting for the packet decoder, must be power of 2 */
+#define ICP_BUFFER_SIZE	16		// bytes main() may fall behind, the MAC check takes a few
+#define ICP_BUFFER_MASK	(ICP_BUFFER_SIZE - 1)
+
+#if (ICP_BIT_MAX * 10UL > 0x7FFF)
+#error "BAUDRATE too low for the input capture"
+#endif
+#endif
+
+/* decoder states, one per field of the packet */
+enum rx_state {
+	RX_HEAD, RX_SIGN, RX_ID_H, RX_ID_L, RX_LEN, RX_SEQ, RX_CMD, RX_DATA, RX_MAC,
+	RX_CRC8
+};
+
+/* field following the payload */
+#if (AUTH != AUTH_NONE)
+#define RX_TAIL	RX_MAC
+#else
+#define RX_TAIL	RX_CRC8
+#endif
+
+/* paired remotes, oldest first, erased slots hold RX_ID_NONE */
+static uint16_t EEMEM rx_pairs_ee[RX_PAIR_MAX] = {
+	[0 ... RX_PAIR_MAX - 1] = RX_ID_NONE
+};
+
+static volatile struct rx_packet rx_buf[RX_BUFFER_SIZE];
 static volatile uint8_t rx_head = 0;
 static volatile uint8_t rx_tail = 0;
 
-static volatile uint8_t has_head = 0;
-static volatile uint8_t has_sign = 0;
-static volatile uint8_t has_data = 0;
-static volatile uint8_t has_crc8 = 0;
+static volatile uint8_t rx_state = RX_HEAD;
+static volatile uint8_t rx_count = 0;	// payload bytes received so far
+static volatile uint8_t rx_crc8 = 0;	// running checksum of the packet
+static volatile uint8_t rx_nibble = 0;	// first half of a coded byte, 0x10 set
+static volatile uint8_t rx_slot;		// pairing slot of the sender, RX_PAIR_MAX if unknown
+static volatile uint8_t rx_last_seq[RX_PAIR_MAX + 1];	// last packet per sender
+static volatile uint8_t rx_seen = 0;	// bit mask, rx_last_seq[] is valid
+static volatile uint8_t rx_pairing = 0;	// unknown remotes may pair
+static uint16_t rx_pairs[RX_PAIR_MAX];	// copy of rx_pairs_ee for the ISR
+static volatile uint16_t rx_clock = 0;	// rx_tick() count
+static volatile struct rx_stats rx_counters;
+
+#if (RX_INPUT == RX_INPUT_ICP)
+static uint16_t icp_last;		// ICR1 at the last edge
+static uint16_t icp_bit = ICP_BIT;	// tracked bit period in timer ticks
+static uint8_t icp_n = 0;		// bits of the byte so far, 0 while waiting for a start bit
+static uint8_t icp_shift;		// data bits so far
+static uint8_t icp_idle = 1;	// the next edge only resyncs, the level before it is unknown
+static uint8_t icp_data[ICP_BUFFER_SIZE];
+static uint8_t icp_status[ICP_BUFFER_SIZE];	// UCSRA flags of each byte
+static volatile uint8_t icp_head = 0;
+static volatile uint8_t icp_tail = 0;
+#endif
+
+#if RX_VOTE
+static uint8_t rx_copy[3][RX_FRAME_MAX];	// frame being received and the last bad copies
+static uint8_t rx_cur = 0;		// rx_copy[] row of the frame being received
+static uint8_t rx_pos;			// bytes of it so far
+static uint8_t rx_bad = 0;		// bad copies kept in the rows before rx_cur
+static uint16_t rx_bad_time;	// rx_clock at the last one
+#endif
 
-static volatile uint8_t cur_data = 0;
-static volatile uint8_t cur_crc8 = 0;
+#if (AUTH != AUTH_NONE)
+static uint8_t EEMEM rx_key_ee[16] = AUTH_KEY;
+static uint32_t rx_ctr[RX_PAIR_MAX + 1];	// the last one is for pairing
+static uint32_t rx_ctr_saved[RX_PAIR_MAX];	// as of the last snapshot
+static uint8_t rx_ctr_new;		// slots changed since then
+static struct rx_packet rx_hold;	// verified, waits for the next snapshot
+static uint8_t rx_held;			// its slot + 1, 0 if none
+#endif
 
 void rx_init(void) {
+#if (AUTH != AUTH_NONE)
+	uint8_t key[16];
+
+#endif
 	/* set baud rate */UBRRL = (uint8_t) (UBRRVAL);
 	UBRRH = (uint8_t) (UBRRVAL >> 8);
+	UCSRA = UART_2X ? (1 << U2X) : 0;
+#if (RX_INPUT == RX_INPUT_ICP)
+	/* the UART only ever transmits, for DIAG */UCSRB = 0;
+#else
 	/* enable receiver only */UCSRB = (1 << RXCIE) | (1 << RXEN);
+#endif
 	/* set frame format: asynchronous mode, 8-bit data, no parity, 1 stop bit  */
 	UCSRC = (1 << URSEL) | (3 << UCSZ0);
+
+#if (RX_INPUT == RX_INPUT_ICP)
+	cbit(ddr(ICP_PORT), ICP_PIN);	// input, driven by the RF module
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);	// normal mode, clk/1, falling edge
+	if (bit_is_clr(pin(ICP_PORT), ICP_PIN)) {
+		sbit(TCCR1B, ICES1);	// wait for the line to go idle
+	}
+	TIFR = (1 << ICF1);
+	sbit(TIMSK, TICIE1);
+#endif
+
+	eeprom_read_block(rx_pairs, rx_pairs_ee, sizeof(rx_pairs));
+
+#if (AUTH != AUTH_NONE)
+	eeprom_read_block(key, rx_key_ee, sizeof(key));
+	auth_init(key);
+#endif
+}
+
+void rx_pair_open(uint8_t open) {
+	rx_pairing = open;
+}
+
+void rx_pair(uint16_t id) {
+	uint16_t pairs[RX_PAIR_MAX];
+#if (AUTH != AUTH_NONE)
+	uint32_t ctr[RX_PAIR_MAX];
+	uint32_t saved[RX_PAIR_MAX];
+#endif
+	uint8_t i;
+	uint8_t n = 0;
+
+	/* keep the order, a new remote goes to the end and pushes out the
+	 * oldest one once all slots are taken */
+	for (i = 0; i < RX_PAIR_MAX; ++i) {
+		if (rx_pairs[i] == id) {
+			return;
+		}
+		if (rx_pairs[i] != RX_ID_NONE) {
+#if (AUTH != AUTH_NONE)
+			ctr[n] = rx_ctr[i];
+			saved[n] = rx_ctr_saved[i];
+#endif
+			pairs[n++] = rx_pairs[i];
+		}
+	}
+	if (n == RX_PAIR_MAX) {
+		for (i = 1; i < RX_PAIR_MAX; ++i) {
+#if (AUTH != AUTH_NONE)
+			ctr[i - 1] = ctr[i];
+			saved[i - 1] = saved[i];
+#endif
+			pairs[i - 1] = pairs[i];
+		}
+		--n;
+	}
+#if (AUTH != AUTH_NONE)
+	ctr[n] = rx_ctr[RX_PAIR_MAX];	// from its verified CMD_PAIR
+	saved[n] = ctr[n];
+#endif
+	pairs[n++] = id;
+	while (n < RX_PAIR_MAX) {
+#if (AUTH != AUTH_NONE)
+		ctr[n] = saved[n] = 0;
+#endif
+		pairs[n++] = RX_ID_NONE;
+	}
+
+	/* slots have moved, forget the sequence numbers seen so far */
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for (i = 0; i < RX_PAIR_MAX; ++i) {
+			rx_pairs[i] = pairs[i];
+#if (AUTH != AUTH_NONE)
+			rx_ctr[i] = ctr[i];
+			rx_ctr_saved[i] = saved[i];
+#endif
+		}
+		rx_seen = 0;
+	}
+
+	eeprom_update_block(pairs, rx_pairs_ee, sizeof(pairs));
+#if (AUTH != AUTH_NONE)
+	rx_ctr_new = 1;	// the new remote's counter is not in the log yet
+#endif
+}
+
+#if (AUTH != AUTH_NONE)
+/* counters are matched to the slots by ID, a remote the log does not know
+ * starts from 0 */
+void rx_restore(const uint8_t *saved, uint8_t skip) {
+	const uint8_t *s;
+	uint8_t i, j;
+
+	for (i = 0; i < RX_PAIR_MAX; ++i) {
+		rx_ctr[i] = 0;
+		for (j = 0, s = saved; saved && j < RX_PAIR_MAX; ++j, s += 6) {
+			if (rx_pairs[i] != RX_ID_NONE
+					&& (((uint16_t) s[0] << 8) | s[1]) == rx_pairs[i]) {
+				rx_ctr[i] = s[2] | ((uint32_t) s[3] << 8)
+						| ((uint32_t) s[4] << 16) | ((uint32_t) s[5] << 24);
+			}
+		}
+		if (skip) {
+			rx_ctr[i] += RX_CTR_SKIP;
+		}
+		rx_ctr_saved[i] = rx_ctr[i];
+	}
+}
+
+void rx_snapshot(uint8_t *saved) {
+	uint8_t i;
+
+	for (i = 0; i < RX_PAIR_MAX; ++i, saved += 6) {
+		saved[0] = rx_pairs[i] >> 8;
+		saved[1] = rx_pairs[i] & 0xFF;
+		saved[2] = rx_ctr[i];
+		saved[3] = rx_ctr[i] >> 8;
+		saved[4] = rx_ctr[i] >> 16;
+		saved[5] = rx_ctr[i] >> 24;
+		rx_ctr_saved[i] = rx_ctr[i];
+	}
+	rx_ctr_new = 0;
+}
+
+/* half way to the limit, a burst goes on without a refused command as
+ * long as the snapshot is written before the next RX_CTR_SKIP / 2 */
+uint8_t rx_save_due(void) {
+	uint8_t i;
+
+	for (i = 0; i < RX_PAIR_MAX; ++i) {
+		if (rx_ctr[i] - rx_ctr_saved[i] >= RX_CTR_SKIP / 2) {
+			return 1;
+		}
+	}
+	return rx_ctr_new;
+}
+#endif
+
+/* the packet repeats or is older than the last one accepted from slot */
+static inline uint8_t rx_repeat(uint8_t slot, uint8_t seq) {
+	return (rx_seen & (1 << slot))
+			&& (uint8_t) (rx_last_seq[slot] - seq) < RX_SEQ_WINDOW;
+}
+
+#if (AUTH != AUTH_NONE)
+/* check the MAC of a packet and move its remote's counter forward */
+static uint8_t rx_verify(const struct rx_packet *pkt, uint8_t slot) {
+	uint8_t msg[PACKET_DATA_MAX + 5];
+	uint8_t mac[AUTH_MAC_SIZE];
+	uint32_t ctr;
+	uint8_t i;
+
+	if (pkt->cmd == CMD_PAIR) {
+		/* carries the whole counter, which only has to move forward */
+		if (pkt->len != 4) {
+			return 0;
+		}
+		ctr = pkt->data[0] | ((uint32_t) pkt->data[1] << 8)
+				| ((uint32_t) pkt->data[2] << 16) | ((uint32_t) pkt->data[3] << 24);
+		if (slot != RX_PAIR_MAX && (int32_t) (ctr - rx_ctr[slot]) <= 0) {
+			return 0;
+		}
+	} else {
+		/* SEQ is the low byte, the rest follows the last counter */
+		if (slot == RX_PAIR_MAX) {
+			return 0;
+		}
+		i = pkt->seq - (uint8_t) rx_ctr[slot];
+		if (i == 0 || i > AUTH_WINDOW) {
+			return 0;
+		}
+		ctr = rx_ctr[slot] + i;
+	}
+
+	msg[0] = pkt->id >> 8;
+	msg[1] = pkt->id & 0xFF;
+	msg[2] = pkt->len + 1;
+	msg[3] = pkt->seq;
+	msg[4] = pkt->cmd;
+	for (i = 0; i < pkt->len; ++i) {
+		msg[5 + i] = pkt->data[i];
+	}
+	auth_mac(mac, ctr, msg, 5 + pkt->len);
+	for (i = 0; i < AUTH_MAC_SIZE; ++i) {
+		if (mac[i] != pkt->mac[i]) {
+			return 0;
+		}
+	}
+
+	rx_ctr[slot] = ctr;
+	return 1;
 }
+#endif
 
-uint8_t rx_getcmd(void) {
+uint8_t rx_pending(void) {
+#if (AUTH != AUTH_NONE)
+	if (rx_held) {
+		return 1;
+	}
+#endif
+	return rx_head != rx_tail;
+}
+
+void rx_tick(void) {
+	++rx_clock;
+}
+
+uint16_t rx_time(void) {
+	uint16_t t;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		t = rx_clock;
+	}
+	return t;
+}
+
+void rx_stats(struct rx_stats *stats) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		stats->frames = rx_counters.frames;
+		stats->crc = rx_counters.crc;
+		stats->voted = rx_counters.voted;
+		stats->repeats = rx_counters.repeats;
+		stats->drops = rx_counters.drops;
+		stats->mac = rx_counters.mac;
+		stats->fe = rx_counters.fe;
+		stats->dor = rx_counters.dor;
+		stats->resync = rx_counters.resync;
+		stats->last = rx_counters.last;
+	}
+}
+
+uint8_t rx_getcmd(struct rx_packet *pkt) {
 	uint8_t tmptail;
-	uint8_t data;
+	uint8_t i;
+#if (AUTH != AUTH_NONE)
+	uint8_t repeat, ahead;
+
+	/* a held packet goes first, once its counter has been saved */
+	if (rx_held) {
+		if (rx_ctr[rx_held - 1] - rx_ctr_saved[rx_held - 1] > RX_CTR_SKIP) {
+			return 0;
+		}
+		*pkt = rx_hold;
+		rx_held = 0;
+		return pkt->cmd;
+	}
+#endif
 
 	if (rx_head == rx_tail) {
 		return 0;	// no data available
 	}
 
 	tmptail = (rx_tail + 1) & RX_BUFFER_MASK;	// calculate buffer index
+
+	/* copy the packet out before releasing its slot to the ISR */
+	pkt->time = rx_buf[tmptail].time;
+	pkt->id = rx_buf[tmptail].id;
+	pkt->seq = rx_buf[tmptail].seq;
+	pkt->cmd = rx_buf[tmptail].cmd;
+	pkt->len = rx_buf[tmptail].len;
+	for (i = 0; i < pkt->len; ++i) {
+		pkt->data[i] = rx_buf[tmptail].data[i];
+	}
+#if (AUTH != AUTH_NONE)
+	for (i = 0; i < AUTH_MAC_SIZE; ++i) {
+		pkt->mac[i] = rx_buf[tmptail].mac[i];
+	}
+#endif
+
 	rx_tail = tmptail;							// store buffer index
-	data = rx_buf[tmptail];						// get data from buffer
 
-	return data;
+#if (AUTH != AUTH_NONE)
+	/* the cipher runs here with interrupts on, never in the ISR. Only a
+	 * packet that passed it moves the repeat filter on, a forged one must
+	 * not get the real remote's next packets dropped. */
+	for (i = 0; i < RX_PAIR_MAX && rx_pairs[i] != pkt->id; ++i)
+		;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		repeat = rx_repeat(i, pkt->seq);
+		if (repeat) {
+			++rx_counters.repeats;	// a copy queued before the first was checked
+		}
+	}
+	if (repeat) {
+		return 0;
+	}
+	if (!rx_verify(pkt, i)) {
+		++rx_counters.mac;	// the ISR leaves this one alone
+		return 0;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		rx_last_seq[i] = pkt->seq;
+		rx_seen |= 1 << i;
+	}
+
+	/* past the limit a power cut could let the packet be replayed, it is
+	 * held until the next snapshot. CMD_PAIR only ever moves the counter
+	 * forward, it gets through. */
+	ahead = i != RX_PAIR_MAX && pkt->cmd != CMD_PAIR
+			&& rx_ctr[i] - rx_ctr_saved[i] > RX_CTR_SKIP;
+	if (ahead) {
+		rx_hold = *pkt;
+		rx_held = i + 1;
+		return 0;
+	}
+#endif
+	return pkt->cmd;
 }
 
-static void rx_flush(void) {
-	has_head = 0;
-	has_sign = 0;
-	has_data = 0;
-	has_crc8 = 0;
+/* a frame passed its checksum, queue it unless it is a repeat, stale or
+ * from an unknown remote that does not ask to pair. With AUTH_SPECK the
+ * repeat filter only moves on in rx_getcmd(), once the MAC is good. */
+static void rx_accept(volatile struct rx_packet *pkt, uint8_t tmphead) {
+	uint8_t i = rx_slot;
+
+	++rx_counters.frames;
+	if (rx_repeat(i, pkt->seq) || (i == RX_PAIR_MAX && pkt->cmd != CMD_PAIR)) {
+		++rx_counters.repeats;
+	} else if (tmphead == rx_tail) {
+		++rx_counters.drops;	// may still get in with its next copy
+	} else {
+		pkt->time = rx_time();
+		rx_counters.last = pkt->time;
+#if (AUTH == AUTH_NONE)
+		rx_last_seq[i] = pkt->seq;
+		rx_seen |= 1 << i;
+#endif
+		rx_head = tmphead;	// store new index
+	}
+}
 
-	cur_data = 0;
-	cur_crc8 = 0;
+#if RX_VOTE
+/* same ID and LEN */
+static inline uint8_t rx_same(const uint8_t *a, const uint8_t *b) {
+	return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
 }
 
-/* interrupt service routine for receiving data */ISR(USART_RXC_vect) {
-	uint8_t data;
-	uint8_t crc8;
+/* a copy failed its checksum, vote bit by bit with the last two bad copies
+ * if all three carry the same ID and LEN, keep it for the next copy if
+ * that does not give a good frame either */
+static uint8_t rx_vote(volatile struct rx_packet *pkt) {
+	uint8_t *c = rx_copy[rx_cur];
+	uint8_t *a = rx_copy[rx_cur == 0 ? 2 : rx_cur - 1];
+	uint8_t *b = rx_copy[rx_cur == 2 ? 0 : rx_cur + 1];
+	uint8_t v[RX_FRAME_MAX];
+	uint8_t crc;
+	uint8_t i;
+
+	uint16_t now = rx_time();
+
+	if ((uint16_t) (now - rx_bad_time) > RX_VOTE_TICKS) {
+		rx_bad = 0;	// left over from an earlier packet
+	}
+	rx_bad_time = now;
+
+	/* copies of some other packet are dropped */
+	if (rx_bad && !rx_same(a, c)) {
+		rx_bad = 0;
+	} else if (rx_bad == 2 && !rx_same(b, c)) {
+		rx_bad = 1;
+	}
+
+	if (rx_bad == 2) {
+		crc = crc8_update(crc8_update(CRC8_INIT, PACKET_HEAD), PACKET_SIGN);
+		for (i = 0; i < rx_pos; ++i) {
+			v[i] = (a[i] & b[i]) | (c[i] & (a[i] | b[i]));
+			crc = crc8_update(crc, v[i]);
+		}
+		if (crc == 0) {	// checksum included
+			pkt->seq = v[3];
+			pkt->cmd = v[4];
+			for (i = 0; i < pkt->len; ++i) {
+				pkt->data[i] = v[5 + i];
+			}
+#if (AUTH != AUTH_NONE)
+			for (i = 0; i < AUTH_MAC_SIZE; ++i) {
+				pkt->mac[i] = v[5 + pkt->len + i];
+			}
+#endif
+			++rx_counters.voted;
+			rx_bad = 0;
+			return 1;
+		}
+	}
+
+	if (rx_bad < 2) {
+		++rx_bad;
+	}
+	rx_cur = rx_cur == 2 ? 0 : rx_cur + 1;
+	return 0;
+}
+#endif
+
+/* decode one byte of the data line, status holds the FE and DOR flags
+ * the way UCSRA reports them */
+static void rx_byte(uint8_t data, uint8_t status) {
 	uint8_t tmphead;
+	uint8_t i;
+	volatile struct rx_packet *pkt;
+#if (LINE_CODE != LINE_CODE_NONE)
+	uint8_t nibble;
+#endif
+
+	/* a lost byte spoils the packet it belongs to, a byte with a bad stop
+	 * bit may still be right and is left to the checksum */
+	if (status & (1 << DOR)) {
+		++rx_counters.dor;
+		if (rx_state > RX_SIGN) {
+			++rx_counters.resync;
+		}
+		rx_state = RX_HEAD;
+	}
+	if (status & (1 << FE)) {
+		++rx_counters.fe;
+	}
+
+#if (LINE_CODE != LINE_CODE_NONE)
+	/* everything after the signature arrives as two symbols per byte */
+	if (rx_state > RX_SIGN) {
+		nibble = lc_decode(data);
+		if (nibble == LC_INVALID) {
+			++rx_counters.resync;
+			rx_state = (data == PACKET_HEAD) ? RX_SIGN : RX_HEAD;
+			return;
+		}
+		if (!rx_nibble) {
+			rx_nibble = 0x10 | nibble;
+			return;
+		}
+		data = (rx_nibble << 4) | nibble;
+		rx_nibble = 0;
+	}
+#endif
 
-	data = UDR;	// read data register
-	crc8 = 0x00;
+#if RX_VOTE
+	if (rx_state > RX_SIGN) {
+		rx_copy[rx_cur][rx_pos++] = data;
+	}
+#endif
 
-	if (data == PACKET_HEAD || data == PACKET_SIGN || data == CMD_PWR
-			|| data == CMD_INC || data == CMD_DEC || data == CRC_CMD_PWR
-			|| data == CRC_CMD_INC || data == CRC_CMD_DEC) {
+	/* decode straight into the next free slot, it is only published once
+	 * the checksum matches */
+	tmphead = (rx_head + 1) & RX_BUFFER_MASK;
+	pkt = &rx_buf[tmphead];
 
+	switch (rx_state) {
+	case RX_HEAD:
 		if (data == PACKET_HEAD) {
-			has_head = 1;
-			packet[0] = data;
-		} else if (data == PACKET_SIGN) {
-			if (has_head) {
-				has_sign = 1;
-				packet[1] = data;
+			rx_state = RX_SIGN;
+		}
+		break;
+	case RX_SIGN:
+		if (data == PACKET_SIGN) {
+			rx_crc8 = crc8_update(crc8_update(CRC8_INIT, PACKET_HEAD), data);
+			rx_nibble = 0;
+#if RX_VOTE
+			rx_pos = 0;
+#endif
+			rx_state = RX_ID_H;
+		} else if (data != PACKET_HEAD) {
+			rx_state = RX_HEAD;
+		}
+		break;
+	case RX_ID_H:
+		rx_crc8 = crc8_update(rx_crc8, data);
+		pkt->id = data << 8;
+		rx_state = RX_ID_L;
+		break;
+	case RX_ID_L:
+		/* early reject, packets for other receivers go no further */
+		pkt->id |= data;
+		for (i = 0; i < RX_PAIR_MAX && rx_pairs[i] != pkt->id; ++i)
+			;
+		if (i == RX_PAIR_MAX && !rx_pairing) {
+			rx_state = (data == PACKET_HEAD) ? RX_SIGN : RX_HEAD;
+			break;
+		}
+		rx_slot = i;
+		rx_crc8 = crc8_update(rx_crc8, data);
+		rx_state = RX_LEN;
+		break;
+	case RX_LEN:
+		if (data == 0 || data > PACKET_DATA_MAX + 1) {
+			++rx_counters.resync;
+			rx_state = (data == PACKET_HEAD) ? RX_SIGN : RX_HEAD;
+			break;
+		}
+		rx_crc8 = crc8_update(rx_crc8, data);
+		pkt->len = data - 1;	// length includes the command byte
+		rx_count = 0;
+		rx_state = RX_SEQ;
+		break;
+	case RX_SEQ:
+		rx_crc8 = crc8_update(rx_crc8, data);
+		pkt->seq = data;
+		rx_state = RX_CMD;
+		break;
+	case RX_CMD:
+		rx_crc8 = crc8_update(rx_crc8, data);
+		pkt->cmd = data;
+		rx_state = pkt->len ? RX_DATA : RX_TAIL;
+		break;
+	case RX_DATA:
+		rx_crc8 = crc8_update(rx_crc8, data);
+		pkt->data[rx_count] = data;
+		if (++rx_count == pkt->len) {
+			rx_state = RX_TAIL;
+		}
+		break;
+#if (AUTH != AUTH_NONE)
+	case RX_MAC:
+		rx_crc8 = crc8_update(rx_crc8, data);
+		pkt->mac[rx_count - pkt->len] = data;
+		if (++rx_count == pkt->len + AUTH_MAC_SIZE) {
+			rx_state = RX_CRC8;
+		}
+		break;
+#endif
+	case RX_CRC8:
+		if (data == rx_crc8) {
+#if RX_VOTE
+			rx_bad = 0;	// the other copies are not needed
+#endif
+			rx_accept(pkt, tmphead);
+			rx_state = RX_HEAD;
+		} else {
+			++rx_counters.crc;
+#if RX_VOTE
+			if (rx_vote(pkt)) {
+				rx_accept(pkt, tmphead);
+				rx_state = RX_HEAD;
+				break;
 			}
-		} else if (data == CMD_PWR || data == CMD_INC || data == CMD_DEC) {
-			if (has_sign) {
-				has_data = 1;
-				cur_data = data;
-				packet[2] = data;
+#endif
+			rx_state = (data == PACKET_HEAD) ? RX_SIGN : RX_HEAD;
+		}
+		break;
+	}
+}
+
+#if (RX_INPUT == RX_INPUT_ICP)
+/* queue a byte for the packet decoder, one that does not fit is lost and
+ * flagged on the byte before it, like DOR of the USART */
+static void icp_put(uint8_t data, uint8_t status) {
+	uint8_t tmphead = (icp_head + 1) & ICP_BUFFER_MASK;
+
+	if (tmphead == icp_tail) {
+		icp_status[icp_head] |= (1 << DOR);
+		return;
+	}
+	icp_data[tmphead] = data;
+	icp_status[tmphead] = status;
+	icp_head = tmphead;
+}
+
+/* a byte in progress cannot be trusted, wait for the next start bit */
+static void icp_drop(void) {
+	if (icp_n) {
+		icp_n = 0;
+		icp_put(0, (1 << DOR));	// takes the place of the lost byte
+	}
+}
+
+/* the line has been at level for n bits, only a falling edge starts a
+ * byte, the rest of a level that completes one is ignored */
+static void icp_bits(uint8_t level, uint8_t n) {
+	while (n--) {
+		if (!icp_n) {
+			if (level) {
+				return;
 			}
-		} else if (data == CRC_CMD_PWR || data == CRC_CMD_INC
-				|| data == CRC_CMD_DEC) {
-			if (has_data) {
-				has_crc8 = 1;
-				cur_crc8 = data;
-
-				switch (cur_data) {
-				case CMD_PWR:
-					crc8 = CRC_CMD_PWR;
-					break;
-				case CMD_INC:
-					crc8 = CRC_CMD_INC;
-					break;
-				case CMD_DEC:
-					crc8 = CRC_CMD_DEC;
-					break;
-				}
-
-				if (cur_crc8 == crc8) {
-					tmphead = (rx_head + 1) & RX_BUFFER_MASK;// calculate buffer index
-					if (tmphead != rx_tail) {
-						rx_head = tmphead;					// store new index
-						rx_buf[tmphead] = cur_data;		// store data in buffer
-					}
-				}
-
-				rx_flush();
+			icp_n = 1;	// start bit
+		} else if (icp_n < 9) {
+			icp_shift = (icp_shift >> 1) | (level ? 0x80 : 0);
+			++icp_n;
+		} else {
+			icp_put(icp_shift, level ? 0 : (1 << FE));
+			icp_n = 0;
+			return;
+		}
+	}
+}
+
+uint8_t rx_bytes(void) {
+	return icp_head != icp_tail;
+}
+
+/* run the packet decoder over the bytes the capture queued. It runs from
+ * main() with interrupts enabled, so edges keep getting captured while it
+ * works and no interrupt ever nests. */
+void rx_poll(void) {
+	uint8_t tmptail;
+	uint8_t data;
+	uint8_t status;
+
+	while (icp_head != icp_tail) {
+		/* icp_put() may still flag DOR on the newest byte */
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			tmptail = (icp_tail + 1) & ICP_BUFFER_MASK;
+			data = icp_data[tmptail];
+			status = icp_status[tmptail];
+			icp_tail = tmptail;
+		}
+		rx_byte(data, status);
+	}
+}
+
+/* an edge of the data line */ISR(TIMER1_CAPT_vect) {
+	uint16_t now = ICR1;
+	uint16_t width = now - icp_last;
+	uint16_t half = icp_bit >> 1;
+	uint8_t level = bit_is_clr(TCCR1B, ICES1);	// of the bits that just ended
+	uint8_t n;
+
+	icp_last = now;
+	tbit(TCCR1B, ICES1);	// wait for the opposite edge
+	TIFR = (1 << ICF1);		// changing ICES1 may set it
+
+	if ((bit_is_set(pin(ICP_PORT), ICP_PIN) != 0) == level) {
+		/* the line went back before ICES1 was turned, an edge is lost */
+		tbit(TCCR1B, ICES1);
+		TIFR = (1 << ICF1);
+		icp_drop();
+		icp_idle = 1;
+	} else if (icp_idle || (!icp_n && level)) {
+		icp_idle = 0;	// resynced, or mark between bytes of any length
+	} else if (width < half) {
+		icp_drop();	// glitch
+	} else {
+		/* round to whole bits by subtraction, the ISR has to be done long
+		 * before the next edge */
+		width += half;
+		for (n = 0; width >= icp_bit && n < 10; ++n) {
+			width -= icp_bit;
+		}
+		/* single bits keep track of the sender's clock */
+		if (n == 1) {
+			icp_bit += (int16_t) (width - half) / 4;
+			if (icp_bit < ICP_BIT_MIN) {
+				icp_bit = ICP_BIT_MIN;
+			} else if (icp_bit > ICP_BIT_MAX) {
+				icp_bit = ICP_BIT_MAX;
 			}
 		}
+		icp_bits(level, n);
+	}
+
+	/* close the byte in the middle of its stop bit unless an edge comes
+	 * first, nothing is due while the line idles at mark */
+	if (icp_n || level) {
+		OCR1A = now + (uint16_t) (10 - icp_n) * icp_bit - (icp_bit >> 1);
+		TIFR = (1 << OCF1A);
+		sbit(TIMSK, OCIE1A);
 	} else {
-		rx_flush();
+		cbit(TIMSK, OCIE1A);
 	}
 }
+
+/* no edge for the rest of a byte, the line stays at its level */ISR(TIMER1_COMPA_vect) {
+	cbit(TIMSK, OCIE1A);
+	icp_bits(bit_is_clr(TCCR1B, ICES1), 10 - icp_n);
+	icp_idle = 1;
+}
+#else
+/* interrupt service routine for receiving data */ISR(USART_RXC_vect) {
+	uint8_t status;
+
+	status = UCSRA;	// error flags are only valid before UDR is read
+	rx_byte(UDR, status);	// read data register
+}
+#endif
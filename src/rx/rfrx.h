@@ -23,19 +23,183 @@
 #ifndef RFRX_H_
 #define RFRX_H_
 
-#define BAUDRATE		2400
-#define UBRRVAL			((F_CPU/(BAUDRATE*16UL))-1)
+#include "auth.h"
+
+/* front end that turns the data line into bytes */
+#define RX_INPUT_UART	0	// hardware USART, data on RXD (PD0)
+#define RX_INPUT_ICP	1	// timer 1 input capture, data on ICP1 (PB0)
+
+#ifndef RX_INPUT
+#define RX_INPUT	RX_INPUT_UART
+#endif
+
+#ifndef BAUDRATE
+#define BAUDRATE		4800
+#endif
+#ifndef UART_2X
+#define UART_2X			1	// double speed, needed above 2400 baud at 1 MHz
+#endif
+
+#if UART_2X
+#define UBRR_DIV		8UL
+#define BAUD_TOL		15	// receiver tolerance in permille, 8N1 at double speed
+#else
+#define UBRR_DIV		16UL
+#define BAUD_TOL		20	// receiver tolerance in permille, 8N1
+#endif
+#define UBRRVAL			((F_CPU+BAUDRATE*UBRR_DIV/2)/(BAUDRATE*UBRR_DIV)-1)
+#define BAUD_REAL		(F_CPU/(UBRR_DIV*(UBRRVAL+1)))
+
+/* the input capture times bits itself, only DIAG on TXD is off then */
+#if (RX_INPUT == RX_INPUT_UART && ((BAUD_REAL*1000 > BAUDRATE*(1000UL+BAUD_TOL)) || (BAUD_REAL*1000 < BAUDRATE*(1000UL-BAUD_TOL))))
+#error "BAUDRATE cannot be generated from F_CPU within the UART tolerance"
+#endif
 
 #define PACKET_HEAD	0xAA	// header
-#define PACKET_SIGN 0x2E
-#define CMD_PWR		0x01	// toggle power on/off
+#define PACKET_SIGN 0x2E	// signature
+#define PACKET_DATA_MAX	4	// maximum payload bytes following the command
+#define CMD_PWR		0x01	// toggle power, or set it from an optional payload byte
 #define CMD_INC		0x02	// increment speed
 #define CMD_DEC		0x03	// decrement speed
-#define CRC_CMD_PWR	0xDF
-#define CRC_CMD_INC	0x3D
-#define CRC_CMD_DEC	0x63
+#define CMD_DELTA	0x04	// change speed by a signed amount, one payload byte
+#define CMD_SPEED	0x05	// set absolute speed, one payload byte
+#define CMD_STATE	0x06	// set power and speed, two payload bytes
+#define CMD_PAIR	0x07	// pair the sending remote, power key held
+#define SPEED_MAX	9
+
+/* packets queued for main(), a power of 2, one slot always stays free */
+#ifndef RX_BUFFER_SIZE
+#define RX_BUFFER_SIZE	8
+#endif
+
+/* bad copies of a packet are combined by majority vote, see below, off as
+ * it needs remotes sending three copies or more */
+#ifndef RX_VOTE
+#define RX_VOTE		0
+#endif
+#define RX_VOTE_MS	250		// copies further apart belong to different packets
+
+#define RX_PAIR_MAX	4		// remotes a receiver can be paired with
+#define RX_ID_NONE	0xFFFF	// erased pairing slot, never used by a remote
+
+/* counts a rolling counter may run past the one last saved, see below */
+#define RX_CTR_SKIP	16
+
+/* bytes rx_snapshot() fills, ID_H ID_L and the counter from its low byte
+ * up for every pairing slot */
+#if (AUTH != AUTH_NONE)
+#define RX_SAVE_SIZE	(RX_PAIR_MAX * 6)
+#else
+#define RX_SAVE_SIZE	0
+#endif
+
+/*
+ * A packet on air is laid out as
+ *
+ *   HEAD SIGN ID_H ID_L LEN SEQ CMD DATA[LEN-1] [MAC] CRC8
+ *
+ * where ID is the 16-bit address of the remote, LEN counts the command
+ * and payload bytes and CRC8 covers every byte from HEAD onwards. Payload
+ * bytes may take any value. The transmitter repeats each packet with the
+ * same SEQ and counts SEQ up from one packet to the next, repeats and
+ * stale packets whose SEQ lies up to RX_SEQ_WINDOW behind the last one
+ * accepted from the same remote are dropped.
+ *
+ * Packets from remotes that are not paired are dropped as soon as their
+ * ID has been received. While pairing is open, unknown remotes get
+ * through with CMD_PAIR only.
+ *
+ * MAC is only sent with AUTH_SPECK, see auth.h. The receive interrupt
+ * only collects it, rx_getcmd() checks it and drops packets that fail.
+ * Only packets that pass move the repeat filter on.
+ *
+ * The counters are not written on every command. main() keeps them in
+ * its log together with state and speed, from rx_snapshot(), and hands
+ * them back to rx_restore() at power-up. rx_getcmd() holds back a
+ * command whose counter lies more than RX_CTR_SKIP past the one last
+ * snapshot until the next one, rx_save_due() asks for it, and well before
+ * the limit is reached. main() opens the log
+ * before it acts on the first command of a burst, and when rx_restore()
+ * is told it was found open, every counter moves RX_CTR_SKIP on, past
+ * anything acted on before the power went. The remote's next presses up
+ * to that point are refused, a power cut in the middle of a burst costs
+ * up to RX_CTR_SKIP presses.
+ *
+ * With RX_VOTE the last two copies that failed their checksum are kept.
+ * When a third copy with the same ID and LEN fails as well, the three are
+ * combined bit by bit by majority vote. CRC8 then decides whether the
+ * voted packet is taken. Copies more than RX_VOTE_MS apart are never
+ * combined. Only packets sent three or more times can get through this
+ * way even if none of their copies arrived intact, so voting needs
+ * TX_REPEAT or EE_REPEAT of the remote at 3 or more. With the default of
+ * 2 it would cost three frames of SRAM and never fire.
+ *
+ * With RX_INPUT_ICP the USART receiver stays off. Timer 1 runs at clk/1
+ * and time-stamps every edge of the data line, the width of each level is
+ * rounded to whole bits. The bit period follows the single-bit pulses the
+ * preamble is made of, so the receiver locks onto the sender's clock
+ * before the packet starts, anywhere within 1/8 of BAUDRATE. A start bit
+ * only begins on a falling edge, pulses shorter than half a bit or edges
+ * missed by the capture drop the byte they fall into, and a compare match
+ * closes the last byte once its stop bit is due. The interrupts only queue
+ * the bytes, rx_poll() runs them through the same packet decoder as those
+ * of the USART. main() has to call it whenever rx_bytes() says so and must
+ * not sleep before. Bytes are lost while main() is blocked for longer than
+ * ICP_BUFFER_SIZE bytes take, by an EEPROM write for instance. Timer 1 is
+ * shared with the software UART of DIAG and cannot drive
+ * SPEED_OUTPUT_TRIAC.
+ */
+struct rx_packet {
+	uint16_t time;	// rx_tick() count when the packet was complete
+	uint16_t id;
+	uint8_t seq;
+	uint8_t cmd;
+	uint8_t len;	// number of payload bytes
+	uint8_t data[PACKET_DATA_MAX];
+#if (AUTH != AUTH_NONE)
+	uint8_t mac[AUTH_MAC_SIZE];
+#endif
+};
+
+/* where the frames went, every counter wraps around */
+struct rx_stats {
+	uint16_t frames;	// complete frames with a good checksum
+	uint16_t crc;		// complete frames with a bad checksum
+	uint16_t voted;		// good frames voted from bad copies, counted in frames too
+	uint16_t repeats;	// good frames dropped as repeats, stale or not let in
+	uint16_t drops;		// good frames dropped because the queue was full
+	uint16_t mac;		// queued frames that failed the MAC check
+	uint16_t fe;		// bytes received with a framing error
+	uint16_t dor;		// bytes lost because UDR was not read in time, or
+						// dropped by the input capture
+	uint16_t resync;	// frames given up before their checksum
+	uint16_t last;		// rx_tick() count when the last packet was queued
+};
 
 void rx_init(void);
-uint8_t rx_getcmd(void);
+uint8_t rx_pending(void);	// a packet is waiting for rx_getcmd()
+#if (RX_INPUT == RX_INPUT_ICP)
+uint8_t rx_bytes(void);		// bytes are waiting for rx_poll()
+void rx_poll(void);			// decode the bytes the input capture queued
+#else
+#define rx_bytes()	0		// the receive interrupt decodes them itself
+#define rx_poll()
+#endif
+uint8_t rx_getcmd(struct rx_packet *pkt);
+void rx_tick(void);			// advance the packet time, from a timer interrupt
+uint16_t rx_time(void);
+
+/* main() ticks the packet time from the timer 0 overflow at clk/64, which
+ * never stops */
+#define RX_TICK_CYCLES	(64UL * 256)
+void rx_stats(struct rx_stats *stats);
+
+void rx_pair_open(uint8_t open);	// let CMD_PAIR from unknown remotes in
+void rx_pair(uint16_t id);			// add a remote, blocks for the EEPROM write
+#if (AUTH != AUTH_NONE)
+void rx_restore(const uint8_t *saved, uint8_t skip);	// saved may be 0
+void rx_snapshot(uint8_t *saved);	// RX_SAVE_SIZE bytes, the new limit
+uint8_t rx_save_due(void);			// a counter nears its limit
+#endif
 
 #endif /* RFRX_H_ */
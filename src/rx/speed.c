@@ -0,0 +1,234 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * speed.c
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "speed.h"
+#include "rfrx.h"
+#include "utils.h"
+
+#if (SPEED_OUTPUT == SPEED_OUTPUT_TRIAC)
+
+#if (RX_INPUT == RX_INPUT_ICP)
+#error "SPEED_OUTPUT_TRIAC needs timer 1, which RX_INPUT_ICP takes"
+#endif
+
+#define TRIAC_PORT	PORTB
+#define TRIAC_PIN	PB1		// OC1A, drives the triac through an opto-coupler
+#define ZC_PORT		PORTD
+#define ZC_PIN		PD2		// INT0, zero-cross detector, rising edge
+
+#define TRIAC_PULSE_US	100		// gate pulse, long enough to latch the triac
+
+/* timer 1 runs at clk/8 */
+#define TRIAC_US(us)	((us) * (F_CPU / 1000UL) / 8000UL)
+#define TRIAC_HALF		TRIAC_US(500000UL / MAINS_HZ)	// one half cycle, means off
+
+/* a gate fired any later would still be on at the next zero cross */
+#define TRIAC_LATEST	(TRIAC_HALF - TRIAC_US(TRIAC_PULSE_US + 500UL))
+
+/* delay change per half cycle, a full sweep takes SPEED_RAMP_MS */
+#define TRIAC_STEP	((TRIAC_HALF * 500UL + SPEED_RAMP_MS * MAINS_HZ / 2) \
+		/ (SPEED_RAMP_MS * MAINS_HZ))
+
+#if (MAINS_HZ != 50 && MAINS_HZ != 60)
+#error "MAINS_HZ must be 50 or 60"
+#endif
+
+#if (TRIAC_HALF > 0xFFFF)
+#error "F_CPU too high for a half cycle on timer 1"
+#endif
+
+#if (TRIAC_STEP == 0)
+#error "SPEED_RAMP_MS too long"
+#endif
+
+/* firing delay after the zero cross for each speed level, the levels get
+ * the same share of the mains power as the duty cycles of the PWM fan
+ * curve, the top level fires as early as the triac latches reliably */
+static const uint16_t speed_delay[SPEED_MAX + 1] PROGMEM = {
+#if (MAINS_HZ == 50)
+	TRIAC_US(6320), TRIAC_US(6160), TRIAC_US(5880), TRIAC_US(5520),
+	TRIAC_US(5130), TRIAC_US(4700), TRIAC_US(4190), TRIAC_US(3590),
+	TRIAC_US(2780), TRIAC_US(500)
+#else
+	TRIAC_US(5270), TRIAC_US(5130), TRIAC_US(4900), TRIAC_US(4600),
+	TRIAC_US(4270), TRIAC_US(3910), TRIAC_US(3490), TRIAC_US(2990),
+	TRIAC_US(2320), TRIAC_US(420)
+#endif
+};
+
+static volatile uint16_t triac_target;	// delay the ramp is heading for
+static uint16_t triac_delay;			// delay of this half cycle, owned by INT0
+
+/* zero cross, step the ramp and schedule the gate pulse */
+ISR(INT0_vect) {
+	uint16_t delay = triac_delay;
+	uint16_t target = triac_target;
+
+	if (delay + TRIAC_STEP < target) {
+		delay += TRIAC_STEP;
+	} else if (delay > target + TRIAC_STEP) {
+		delay -= TRIAC_STEP;
+	} else {
+		delay = target;
+	}
+	triac_delay = delay;
+
+	if (delay >= TRIAC_LATEST) {
+		if (delay == TRIAC_HALF) {
+			cbit(GICR, INT0);	// off, stop watching the mains
+		}
+		return;
+	}
+
+	/* OC1A goes high at the firing angle without any help from the CPU */
+	TCNT1 = 0;
+	OCR1A = delay;
+	TCCR1A = (1 << COM1A1) | (1 << COM1A0);	// set on match
+	TIFR = (1 << OCF1A);
+	sbit(TIMSK, OCIE1A);
+	TCCR1B = (1 << CS11);	// normal mode, clk/8
+}
+
+ISR(TIMER1_COMPA_vect) {
+	if (TCCR1A & (1 << COM1A0)) {
+		/* the gate just went high, end the pulse on the next match */
+		OCR1A += TRIAC_US(TRIAC_PULSE_US);
+		TCCR1A = (1 << COM1A1);	// clear on match
+	} else {
+		/* pulse is over, wait for the next zero cross */
+		cbit(TIMSK, OCIE1A);
+		TCCR1B = 0;
+	}
+}
+
+void speed_init(void) {
+	cbit(TRIAC_PORT, TRIAC_PIN);
+	sbit(ddr(TRIAC_PORT), TRIAC_PIN);	// output
+	cbit(ddr(ZC_PORT), ZC_PIN);			// input
+	sbit(ZC_PORT, ZC_PIN);				// pullup for an open collector detector
+
+	TCCR1A = 0;
+	TCCR1B = 0;
+	MCUCR |= (1 << ISC01) | (1 << ISC00);	// INT0 on the rising edge
+	triac_target = TRIAC_HALF;
+	triac_delay = TRIAC_HALF;
+}
+
+void speed_set(uint8_t state, uint8_t speed) {
+	uint16_t delay = TRIAC_HALF;
+
+	if (state) {
+		delay = pgm_read_word(&speed_delay[speed > SPEED_MAX ? SPEED_MAX : speed]);
+	}
+
+	/* INT0 is the only reader of the target */
+	cbit(GICR, INT0);
+	triac_target = delay;
+	if (delay != TRIAC_HALF || triac_delay != TRIAC_HALF) {
+		sbit(GICR, INT0);
+	}
+}
+
+#else
+
+#define SPEED_PORT	PORTB
+#define SPEED_PIN	PB3		// OC2
+
+/* overflows per ramp step, timer 2 runs at clk/8 so one overflow takes
+ * 2048 cycles and a full sweep has 255 steps */
+#define SPEED_RAMP_DIV	((SPEED_RAMP_MS * (F_CPU / 1000UL) + 8UL * 256 * 255 / 2) / (8UL * 256 * 255))
+
+#if (SPEED_RAMP_DIV == 0 || SPEED_RAMP_DIV > 255)
+#error "SPEED_RAMP_MS out of range for timer 2"
+#endif
+
+/* duty cycle for each speed level, the lowest level still starts a fan */
+static const uint8_t speed_duty[SPEED_MAX + 1] PROGMEM = {
+#ifdef SPEED_CURVE_LINEAR
+	64, 85, 106, 128, 149, 170, 191, 213, 234, 255
+#else
+	64, 71, 84, 101, 121, 143, 168, 195, 224, 255
+#endif
+};
+
+static volatile uint8_t speed_target;	// duty the ramp is heading for
+static volatile uint8_t speed_div;		// overflows left until the next step
+
+/* fast PWM, non-inverting on OC2, clk/8 */
+static void speed_start(void) {
+	TCCR2 = (1 << WGM21) | (1 << WGM20) | (1 << COM21) | (1 << CS21);
+}
+
+/* disconnect OC2 and stop the timer, the pin stays low */
+static void speed_stop(void) {
+	TCCR2 = 0;
+	TCNT2 = 0;
+}
+
+ISR(TIMER2_OVF_vect) {
+	uint8_t duty = OCR2;
+
+	if (--speed_div) {
+		return;
+	}
+	speed_div = SPEED_RAMP_DIV;
+
+	if (duty < speed_target) {
+		++duty;
+	} else if (duty > speed_target) {
+		--duty;
+	}
+	OCR2 = duty;	// double buffered, takes effect at the next period
+
+	if (duty == speed_target) {
+		cbit(TIMSK, TOIE2);
+		if (!duty) {
+			speed_stop();
+		}
+	}
+}
+
+void speed_init(void) {
+	cbit(SPEED_PORT, SPEED_PIN);
+	sbit(ddr(SPEED_PORT), SPEED_PIN);	// output
+	OCR2 = 0;
+	speed_stop();
+}
+
+void speed_set(uint8_t state, uint8_t speed) {
+	uint8_t duty = 0;
+
+	if (state) {
+		duty = pgm_read_byte(&speed_duty[speed > SPEED_MAX ? SPEED_MAX : speed]);
+	}
+
+	cbit(TIMSK, TOIE2);
+	speed_target = duty;
+	if (OCR2 != duty) {
+		speed_div = SPEED_RAMP_DIV;
+		speed_start();
+		sbit(TIMSK, TOIE2);
+	}
+}
+
+#endif /* SPEED_OUTPUT */
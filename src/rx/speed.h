@@ -0,0 +1,58 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * speed.h
+ */
+
+#ifndef SPEED_H_
+#define SPEED_H_
+
+#include <stdint.h>
+
+#define SPEED_OUTPUT_PWM	0	// DC fan, PWM on OC2
+#define SPEED_OUTPUT_TRIAC	1	// AC fan, phase-angle control of a triac
+
+#ifndef SPEED_OUTPUT
+#define SPEED_OUTPUT	SPEED_OUTPUT_PWM
+#endif
+
+/* mains frequency for SPEED_OUTPUT_TRIAC, 50 or 60 Hz */
+#ifndef MAINS_HZ
+#define MAINS_HZ	50
+#endif
+
+/* time for the output to sweep from off to full duty */
+#ifndef SPEED_RAMP_MS
+#define SPEED_RAMP_MS	1000
+#endif
+
+/*
+ * With SPEED_OUTPUT_PWM the speed is put out as PWM on OC2 (PB3) by timer
+ * 2, the duty cycle for each level comes from a table in flash. Changes
+ * are ramped from the timer 2 overflow interrupt, which is only enabled
+ * while ramping. Define SPEED_CURVE_LINEAR for evenly spaced levels
+ * instead of the fan curve.
+ *
+ * With SPEED_OUTPUT_TRIAC a zero-cross detector on INT0 (PD2) starts timer
+ * 1 every mains half cycle, and OC1A (PB1) fires the triac gate after the
+ * delay for the current level. The pin is switched by the compare match
+ * itself, so a byte being decoded by the UART interrupt does not move the
+ * firing angle. Timer 2 is left unused.
+ */
+void speed_init(void);
+void speed_set(uint8_t state, uint8_t speed);
+
+#endif /* SPEED_H_ */
@@ -0,0 +1,41 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * interrupt.h
+ *
+ * Interrupt handlers become plain functions which the simulator calls
+ * from sim_io() whenever the global interrupt flag is set.
+ */
+
+#ifndef SIM_AVR_INTERRUPT_H_
+#define SIM_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define sei()	(SREG |= _BV(SREG_I))
+#define cli()	(SREG &= ~_BV(SREG_I))
+#define reti()
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define ISR_ALIASOF(v)
+
+#define ISR(vector, ...)		void vector(void); void vector(void)
+#define EMPTY_INTERRUPT(vector)	void vector(void); void vector(void) {}
+#define BADISR_vect				__vector_default
+
+#endif /* SIM_AVR_INTERRUPT_H_ */
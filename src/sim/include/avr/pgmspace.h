@@ -0,0 +1,39 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * pgmspace.h
+ *
+ * Program memory is ordinary read-only data on the host.
+ */
+
+#ifndef SIM_AVR_PGMSPACE_H_
+#define SIM_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P					const char *
+#define PSTR(s)					(s)
+
+#define pgm_read_byte(addr)		(*(const uint8_t *) (addr))
+#define pgm_read_word(addr)		(*(const uint16_t *) (addr))
+#define pgm_read_dword(addr)	(*(const uint32_t *) (addr))
+
+#define memcpy_P(dst, src, n)	memcpy((dst), (src), (n))
+#define strlen_P(s)				strlen(s)
+
+#endif /* SIM_AVR_PGMSPACE_H_ */
@@ -0,0 +1,37 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * sleep.h
+ */
+
+#ifndef SIM_AVR_SLEEP_H_
+#define SIM_AVR_SLEEP_H_
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE			0
+#define SLEEP_MODE_ADC			_BV(SM0)
+#define SLEEP_MODE_PWR_DOWN		_BV(SM1)
+#define SLEEP_MODE_PWR_SAVE		(_BV(SM0) | _BV(SM1))
+#define SLEEP_MODE_STANDBY		(_BV(SM1) | _BV(SM2))
+
+#define set_sleep_mode(mode)	(MCUCR = (MCUCR & ~(_BV(SM0) | _BV(SM1) | _BV(SM2))) | (mode))
+#define sleep_enable()			(MCUCR |= _BV(SE))
+#define sleep_disable()			(MCUCR &= ~_BV(SE))
+#define sleep_cpu()				sim_sleep()
+#define sleep_mode()			do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
+
+#endif /* SIM_AVR_SLEEP_H_ */
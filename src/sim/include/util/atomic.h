@@ -0,0 +1,60 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * atomic.h
+ *
+ * Same construction as avr-libc, operating on the simulated SREG.
+ */
+
+#ifndef SIM_UTIL_ATOMIC_H_
+#define SIM_UTIL_ATOMIC_H_
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+static __inline__ uint8_t __iSeiRetVal(void) {
+	sei();
+	return 1;
+}
+
+static __inline__ uint8_t __iCliRetVal(void) {
+	cli();
+	return 1;
+}
+
+static __inline__ void __iSeiParam(const uint8_t *__s) {
+	sei();
+	(void) __s;
+}
+
+static __inline__ void __iCliParam(const uint8_t *__s) {
+	cli();
+	(void) __s;
+}
+
+static __inline__ void __iRestore(const uint8_t *__s) {
+	SREG = *__s;
+}
+
+#define ATOMIC_BLOCK(type)		for (type, __ToDo = __iCliRetVal(); __ToDo; __ToDo = 0)
+#define NONATOMIC_BLOCK(type)	for (type, __ToDo = __iSeiRetVal(); __ToDo; __ToDo = 0)
+
+#define ATOMIC_RESTORESTATE		uint8_t sreg_save __attribute__((__cleanup__(__iRestore))) = SREG
+#define ATOMIC_FORCEON			uint8_t sreg_save __attribute__((__cleanup__(__iSeiParam))) = 0
+#define NONATOMIC_RESTORESTATE	uint8_t sreg_save __attribute__((__cleanup__(__iRestore))) = SREG
+#define NONATOMIC_FORCEOFF		uint8_t sreg_save __attribute__((__cleanup__(__iCliParam))) = 0
+
+#endif /* SIM_UTIL_ATOMIC_H_ */
@@ -0,0 +1,37 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * delay.h
+ */
+
+#ifndef SIM_UTIL_DELAY_H_
+#define SIM_UTIL_DELAY_H_
+
+#include <avr/io.h>
+
+#ifndef F_CPU
+#error "F_CPU must be defined for util/delay.h"
+#endif
+
+static inline void _delay_us(double us) {
+	sim_delay((uint32_t) (us * (F_CPU / 1e6)));
+}
+
+static inline void _delay_ms(double ms) {
+	sim_delay((uint32_t) (ms * (F_CPU / 1e3)));
+}
+
+#endif /* SIM_UTIL_DELAY_H_ */
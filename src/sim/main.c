@@ -0,0 +1,1884 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * main.c
+ *
+ * rfsim - runs the transmitter and receiver firmware side by side and
+ * connects them through a simulated 433 MHz OOK link.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <dlfcn.h>
+
+#include "mcu.h"
+
+#define F_SIM			1000000UL	// both boards run from the 1 MHz RC oscillator
+#define QUANTUM			100			// cycles the boards run between sync points
+
+/* transmitter wiring, see src/tx/main.c */
+#define TX_RF_GND		SIM_PIN('C', 5)	// RF module ground, active low
+#define TX_KEY_ROW		SIM_PIN('D', 3)
+#define TX_KEY_PWR		SIM_PIN('B', 5)
+#define TX_KEY_INC		SIM_PIN('B', 4)
+#define TX_KEY_DEC		SIM_PIN('B', 3)
+
+/* receiver wiring, see src/rx/speed.c */
+#define RX_SPEED		SIM_PIN('B', 3)	// PWM speed output
+#define RX_GATE			SIM_PIN('B', 1)	// triac gate
+#define RX_ZC			SIM_PIN('D', 2)	// zero-cross detector
+#define RX_ICP			SIM_PIN('B', 0)	// data line with RX_INPUT_ICP, see src/rx/rfrx.h
+
+#define RX_DIAG			SIM_PIN('D', 4)	// telemetry, software UART
+#define RX_DIAG_JMP		SIM_PIN('D', 7)	// jumper to ground, telemetry on TXD
+
+#define LINE_LEVELS		32			// RX_ICP levels queued ahead, about three frames
+#define ZC_PULSE_US		200			// detector output is high around the zero cross
+#define DIAG_BAUD		2400		// software UART, see src/rx/diag.h
+
+/* supply currents of the transmitter at 3 V, ATmega8L datasheet typicals */
+#define I_ACTIVE		1.0			// mA, active at 1 MHz
+#define I_IDLE			0.35		// mA, idle at 1 MHz
+#define I_PWR_DOWN		0.0005		// mA, power-down with WDT and BOD off
+#define I_RF			8.0			// mA, 433 MHz module keyed
+
+/* receivers lose their slicing threshold on long runs of one level */
+#define AGC_RUN			4			// bits of the same level the AGC tolerates
+
+/* commands that change the receiver state, see src/rx/rfrx.h */
+#define CMD_PWR			0x01
+#define CMD_INC			0x02
+#define CMD_DEC			0x03
+#define CMD_DELTA		0x04
+#define CMD_SPEED		0x05
+#define CMD_STATE		0x06
+#define CMD_PAIR		0x07
+#define SPEED_MAX		9
+#define PACKET_DATA_MAX	4
+#define PACKET_HEAD		0xAA
+#define PACKET_SIGN		0x2E
+#define MAC_SIZE		4			// AUTH_MAC_SIZE with AUTH_SPECK, see src/rx/auth.h
+
+#define TX_EE_ID		6			// remote address in the transmitter EEPROM
+#define TX_ID			0x0001		// used while TX_EE_ID is erased
+#define TX_EE_CTR		24			// rolling counter with AUTH_SPECK, little endian
+#define TX_EE_SETTLE	28			// transmit profile, continued
+#define TX_REPEAT		2			// copies of a packet with the default profile
+#define TX_EE_HOLD		29
+#define PAIR_HOLD_MS	3000		// power key hold that pairs, KEY_HOLD_MS in src/tx/keypad.h
+
+/* decode benchmark, two remotes paired with the receiver */
+#define BENCH_ID_1		0x1001
+#define BENCH_ID_2		0x2002
+#define BENCH_TAPS		12			// key presses recorded from each remote
+#define BENCH_FLOOD_MS	2000		// key held down on the first remote
+#define CAPTURE_MAX		2048		// bytes recorded off the air
+#define STREAM_MAX		4096		// bytes in one benchmark scenario
+#define FRAMES_MAX		256
+
+#define ms(x)			((uint64_t) ((x) * (F_SIM / 1000.0)))
+
+struct board {
+	const char *name;
+	void *handle;
+	const struct sim_mcu *mcu;
+	struct sim_host host;
+};
+
+/* a command as the transmitter queued it or the receiver handed it over */
+struct frame {
+	uint8_t from;	// low byte of the remote ID
+	uint8_t seq;	// receiver side only
+	uint8_t cmd;
+	uint8_t len;
+	uint8_t data[PACKET_DATA_MAX];
+};
+
+struct stats {
+	unsigned long presses;
+	unsigned long sent;			// commands queued by the transmitter
+	unsigned long decoded;		// commands handed to the receiver main loop
+	unsigned long answered;		// presses followed by at least one command
+	unsigned long bytes;		// bytes put on air
+	unsigned long lost;			// bytes that never made it to the receiver
+	unsigned long synced;		// presses after which both sides agree
+	unsigned long gates;		// triac gate pulses
+	double gate_delay;			// of the last pulse after its zero cross, in us
+	double gate_width;			// in us
+	int power;					// receiver state as the commands left it
+	int speed;
+	int want_power;				// state the sent commands add up to
+	int restored;				// the receiver restored a saved state
+	int want_speed;
+	double latency_sum;
+	double latency_max;
+	unsigned long keyed;		// presses followed by a byte on air
+	double first_sum;			// key press to the first byte on air, in ms
+	double first_max;
+	double bit;					// UART bit on air in cycles
+	unsigned long tx_blocks;	// cipher blocks computed for MACs
+	unsigned long rx_blocks;
+	unsigned long fetched;		// packets rx_getcmd() took off the queue
+	unsigned long rejected;		// of them dropped, e.g. for a bad MAC
+	uint64_t fetch_at;
+	double fetch_sum;			// time spent in rx_getcmd() on them, in ms
+	double fetch_max;
+	unsigned long overruns;		// receiver UART bytes lost to a full FIFO
+	uint16_t counters[SIM_RX_STATS];	// the receiver's own, see rx_stats()
+	uint64_t rf_on;			// cycles the RF module was powered
+	uint64_t rf_settle;		// part of rf_on before the first byte went out
+	struct sim_power tx;	// transmitter clock breakdown, boot excluded
+	struct sim_power rx;	// receiver clock breakdown, boot excluded
+};
+
+static struct {
+	double ber;				// bit error rate on air
+	double agc;				// error rate of bits past AGC_RUN equal ones
+	double noise;			// garbage bytes per second while nobody transmits
+	double skew;			// transmitter clock error in percent
+	double settle;			// RF module settle time in ms
+	double bounce;			// contact bounce after a key changes, in ms
+	double hold;			// key press length in ms
+	double period;			// time between key presses in ms
+	double daily;			// key presses per day for the battery model
+	double capacity;		// battery capacity in mAh
+	double mains;			// mains frequency seen by the zero-cross detector
+	unsigned long presses;
+	unsigned long seed;
+	int verbose;
+	int bench;				// only run the decode benchmark
+	double least;			// benchmark delivery rate in percent it must reach
+	const char *corpus;		// the benchmark replays
+	const char *record;		// write a new corpus to, from the firmware
+	int profile[5];			// transmit profile patched into the EEPROM
+} opt = { -1.0, 0.0, 0.0, 0.0, 2.0, 0.0, 20.0, 400.0, 50.0, 220.0, 50.0, 200, 1,
+		0, 0, 85.0, "bench.corpus", 0, { -1, -1, -1, -1, -1 } };
+
+static char dir[PATH_MAX];
+static uint8_t rx_paired[SIM_EEPROM_SIZE];	// receiver EEPROM once paired
+static uint8_t rx_paired_valid;
+static uint8_t tx_paired_ctr[4];	// the remote's rolling counter at that time
+static struct board tx = { "tx" };
+static struct board rx = { "rx" };
+static struct stats st;
+
+static uint64_t now;
+static uint64_t rf_on_since;
+static uint8_t rf_on;
+static uint8_t rf_idle;		// no byte sent since the module was powered
+static uint64_t air_busy_until;
+static uint64_t air_mark_since;	// end of the last frame on air
+static unsigned long air_mark_run;	// mark bits that frame ended with
+static uint64_t press_at;
+static uint8_t press_pending;
+static uint8_t press_keyed;		// first byte after the press is still to come
+static uint8_t rx_cmd;			// last command seen by the receiver
+static uint8_t rx_arg;			// payload bytes of it seen so far
+static uint8_t tx_cmd;			// last command sent by the transmitter
+static uint8_t tx_arg;
+static unsigned long zc_count;	// zero crosses queued, one every half cycle
+static uint64_t gate_on;
+static struct {
+	uint8_t level;
+	uint64_t when;
+} line[LINE_LEVELS];			// levels of RX_ICP still to come
+static unsigned line_n;
+static uint64_t line_end;		// of the transmitter's last frame on RX_ICP
+static struct {
+	uint8_t data;
+	uint64_t start;
+} capture[CAPTURE_MAX];			// bytes on air while capturing
+static unsigned capture_n;
+static uint8_t capture_on;
+static struct frame sent[FRAMES_MAX];	// commands queued while capturing
+static unsigned sent_n;
+static uint8_t tx_from;			// low byte of the transmitter ID
+static struct frame taken[FRAMES_MAX];	// commands handed over while taking
+static unsigned taken_n;
+static uint8_t taking;
+static uint8_t rx_from;			// of the command being handed over
+static uint8_t rx_seq;
+static char diag_line[128];		// telemetry line being received
+static unsigned diag_len;
+static char diag_last[128];		// last complete one
+static unsigned long diag_lines;
+static uint64_t soft_start;		// start bit of the byte on RX_DIAG, 0 if idle
+static uint8_t soft_level = 1;
+static uint8_t soft_next;		// next bit to sample, 8 is the stop bit
+static uint8_t soft_byte;
+
+static double rnd(void) {
+	return (double) random() / ((double) RAND_MAX + 1.0);
+}
+
+/*
+ * channel
+ */
+
+/* start bit, data bits LSB first and stop bit */
+static void frame_bits(uint8_t *bits, uint8_t data, uint8_t stop) {
+	int i;
+
+	bits[0] = 0;
+	for (i = 0; i < 8; ++i) {
+		bits[1 + i] = (data >> i) & 1;
+	}
+	bits[9] = stop;
+}
+
+/* the same frame on the data line into the input capture, which idles at
+ * mark, the receiver with the USART leaves the pin alone. The transmitter
+ * only starts a frame once its last one is over, its bytes keep coming
+ * back to back with a slow clock. Noise cuts a frame short. */
+static void line_send(const uint8_t *bits, uint64_t start, double bit, int tx) {
+	int i;
+
+	if (tx) {
+		if (start < line_end) {
+			start = line_end;
+		}
+		line_end = start + (uint64_t) (10 * bit);
+	}
+	while (line_n && line[line_n - 1].when >= start) {
+		--line_n;
+	}
+	for (i = 0; i <= 10 && line_n < LINE_LEVELS; ++i) {
+		line[line_n].level = i < 10 ? bits[i] : 1;
+		line[line_n].when = start + (uint64_t) (i * bit);
+		++line_n;
+	}
+}
+
+/* hand the receiver the levels up to the given time, later ones may still
+ * be cut short */
+static void line_flush(uint64_t until) {
+	unsigned i;
+	unsigned n = 0;
+
+	while (n < line_n && line[n].when <= until) {
+		rx.mcu->input(RX_ICP, line[n].level, line[n].when);
+		++n;
+	}
+	for (i = n; i < line_n; ++i) {
+		line[i - n] = line[i];
+	}
+	line_n -= n;
+}
+
+/* put one UART frame on air and sample it the way the receiver would */
+static void channel_send(uint8_t data, uint64_t start, double bit) {
+	uint8_t sent[10];
+	uint8_t frame[10];
+	uint8_t out = 0;
+	double rbit = rx.mcu->uart_bit();
+	double tbit = bit * (1.0 + opt.skew / 100.0);
+	unsigned long run;
+	int i;
+
+	++st.bytes;
+	air_busy_until = start + (uint64_t) (10 * tbit);
+	if (press_keyed) {
+		double first = (start - press_at) / (F_SIM / 1000.0);
+
+		press_keyed = 0;
+		++st.keyed;
+		st.first_sum += first;
+		if (first > st.first_max) {
+			st.first_max = first;
+		}
+	}
+	if (rf_on && rf_idle) {
+		st.rf_settle += start - rf_on_since;
+		rf_idle = 0;
+	}
+
+	if (!rf_on || start < rf_on_since + ms(opt.settle)) {
+		++st.lost;	// carrier is off or still settling
+		return;
+	}
+
+	/* mark bits leading up to the start bit, the carrier idles at mark */
+	if (air_mark_since >= rf_on_since) {
+		run = air_mark_run + (unsigned long) ((start - air_mark_since) / tbit);
+	} else {
+		run = (unsigned long) ((start - rf_on_since) / tbit);
+	}
+
+	frame_bits(sent, data, 1);
+	for (i = 0; i < 10; ++i) {
+		run = (i ? sent[i - 1] : 1) == sent[i] ? run + 1 : 1;
+		frame[i] = sent[i];
+		if (opt.agc > 0 && run > AGC_RUN && rnd() < opt.agc) {
+			frame[i] ^= 1;
+		} else if (opt.ber > 0 && rnd() < opt.ber) {
+			frame[i] ^= 1;
+		}
+	}
+	air_mark_since = air_busy_until;
+	air_mark_run = run;
+	line_send(frame, start, tbit, 1);
+	if (frame[0]) {
+		++st.lost;	// start bit never seen
+		return;
+	}
+
+	/* receiver samples the middle of its own bit cells */
+	for (i = 0; i < 10; ++i) {
+		int j = (int) ((i + 0.5) * rbit / tbit);
+		uint8_t v = j < 10 ? frame[j] : 1;
+
+		if (i >= 1 && i <= 8) {
+			out |= v << (i - 1);
+		} else if (i == 9) {
+			rx.mcu->uart_rx(out, !v, start + (uint64_t) (9.5 * rbit));
+		}
+	}
+}
+
+/* zero-cross pulses for the receiver, queued one quantum ahead */
+static void mains_step(void) {
+	double half = F_SIM / (2.0 * opt.mains);
+
+	while (opt.mains > 0 && zc_count * half < now + QUANTUM) {
+		uint64_t zc = (uint64_t) (zc_count * half);
+
+		rx.mcu->input(RX_ZC, 1, zc);
+		rx.mcu->input(RX_ZC, 0, zc + ZC_PULSE_US * (F_SIM / 1000000.0));
+		++zc_count;
+	}
+}
+
+static void channel_noise(void) {
+	double p = opt.noise * QUANTUM / F_SIM;
+
+	if (p > 0 && now >= air_busy_until && rnd() < p) {
+		uint8_t bits[10];
+		uint8_t fe = rnd() < 0.5;
+		uint8_t data = random() & 0xFF;
+
+		rx.mcu->uart_rx(data, fe, now);
+		frame_bits(bits, data, !fe);
+		line_send(bits, now, rx.mcu->uart_bit(), 0);
+	}
+}
+
+/*
+ * harness callbacks
+ */
+
+/* what a command does to power and speed, cmd alone with arg < 0, then
+ * once per payload byte, the way the receiver applies it */
+static void state_apply(int *power, int *speed, uint8_t cmd, int n, uint8_t arg) {
+	int s = *speed;
+
+	if (n < 0) {
+		*power ^= cmd == CMD_PWR;
+		s += (cmd == CMD_INC) - (cmd == CMD_DEC);
+	} else if (n == 0 && cmd == CMD_PWR) {
+		*power = arg & 1;	// sets instead of toggling
+	} else if (n == 0 && cmd == CMD_DELTA) {
+		s += (int8_t) arg;
+	} else if ((n == 0 && cmd == CMD_SPEED) || (n == 1 && cmd == CMD_STATE)) {
+		s = arg;
+	} else if (n == 0 && cmd == CMD_STATE) {
+		*power = arg & 1;
+	}
+	*speed = s < 0 ? 0 : (s > SPEED_MAX ? SPEED_MAX : s);
+}
+
+static void tx_uart(void *ctx, uint8_t data, uint64_t start, double bit) {
+	(void) ctx;
+	st.bit = bit;
+	if (capture_on && capture_n < CAPTURE_MAX) {
+		capture[capture_n].data = data;
+		capture[capture_n].start = start;
+		++capture_n;
+	}
+	channel_send(data, start, bit);
+}
+
+static void tx_pin(void *ctx, uint8_t pin, uint8_t level, uint64_t when) {
+	(void) ctx;
+	if (pin == TX_RF_GND) {
+		if (rf_on && level) {
+			st.rf_on += when - rf_on_since;
+		}
+		rf_on = !level;
+		if (rf_on) {
+			rf_on_since = when;
+			rf_idle = 1;
+		}
+	}
+}
+
+static void tx_event(void *ctx, uint8_t type, uint8_t arg, uint64_t when) {
+	(void) ctx;
+	if (type == SIM_EV_MAC) {
+		st.tx_blocks += arg;
+	} else if (type == SIM_EV_DATA) {
+		state_apply(&st.want_power, &st.want_speed, tx_cmd, tx_arg, arg);
+		if (capture_on && sent_n && tx_arg < PACKET_DATA_MAX) {
+			sent[sent_n - 1].data[sent[sent_n - 1].len++] = arg;
+		}
+		++tx_arg;
+	} else if (type == SIM_EV_SEND) {
+		tx_cmd = arg;
+		tx_arg = 0;
+		state_apply(&st.want_power, &st.want_speed, arg, -1, 0);
+		++st.sent;
+		if (capture_on && sent_n < FRAMES_MAX) {
+			memset(&sent[sent_n], 0, sizeof(sent[sent_n]));
+			sent[sent_n].from = tx_from;
+			sent[sent_n].cmd = arg;
+			++sent_n;
+		}
+		if (opt.verbose) {
+			printf("%10.3f ms  tx  send %02X\n", when / 1e3, arg);
+		}
+	}
+}
+
+/* one telemetry byte from either port */
+static void diag_char(uint8_t c) {
+	if (c == '\n') {
+		diag_line[diag_len] = 0;
+		memcpy(diag_last, diag_line, diag_len + 1);
+		diag_len = 0;
+		++diag_lines;
+	} else if (c != '\r' && diag_len < sizeof(diag_line) - 1) {
+		diag_line[diag_len++] = c;
+	}
+}
+
+/* sample the software UART in the middle of each bit up to the given time */
+static void soft_advance(uint64_t until) {
+	double bit = F_SIM / (double) DIAG_BAUD;
+
+	while (soft_start && soft_start + (soft_next + 1.5) * bit < until) {
+		if (soft_next < 8) {
+			soft_byte |= soft_level << soft_next++;
+		} else {
+			if (soft_level) {
+				diag_char(soft_byte);	// framing errors are dropped
+			}
+			soft_start = 0;
+		}
+	}
+}
+
+static void rx_uart(void *ctx, uint8_t data, uint64_t start, double bit) {
+	(void) ctx;
+	(void) start;
+	(void) bit;
+	diag_char(data);
+}
+
+static void rx_pin(void *ctx, uint8_t pin, uint8_t level, uint64_t when) {
+	double half = F_SIM / (2.0 * opt.mains);
+
+	(void) ctx;
+	if (pin == RX_DIAG) {
+		soft_advance(when);
+		if (!soft_start && !level) {
+			soft_start = when;
+			soft_next = 0;
+			soft_byte = 0;
+		}
+		soft_level = level;
+	} else if (pin == RX_GATE && level) {
+		gate_on = when;
+		++st.gates;
+		st.gate_delay = fmod(when, half) / (F_SIM / 1000000.0);
+	} else if (pin == RX_GATE) {
+		st.gate_width = (when - gate_on) / (F_SIM / 1000000.0);
+	}
+}
+
+/* time main() spent taking a packet off the queue, MAC check included */
+static void rx_fetched(uint64_t when) {
+	double t = (when - st.fetch_at) / (F_SIM / 1000.0);
+
+	st.fetch_sum += t;
+	if (t > st.fetch_max) {
+		st.fetch_max = t;
+	}
+}
+
+static void rx_event(void *ctx, uint8_t type, uint8_t arg, uint64_t when) {
+	(void) ctx;
+	if (type == SIM_EV_MAC) {
+		st.rx_blocks += arg;
+	} else if (type == SIM_EV_FETCH) {
+		st.fetch_at = when;
+		++st.fetched;
+	} else if (type == SIM_EV_REJECT) {
+		++st.rejected;
+		rx_fetched(when);
+	} else if (type == SIM_EV_RESTORE) {
+		rx_cmd = 0;
+		rx_arg = 0;
+		st.restored = 1;
+		st.power = arg;
+	} else if (type == SIM_EV_DATA) {
+		if (rx_cmd == 0 && rx_arg == 0) {
+			st.speed = arg;
+		} else if (rx_cmd) {
+			state_apply(&st.power, &st.speed, rx_cmd, rx_arg, arg);
+		}
+		if (taking && rx_cmd && taken_n && rx_arg < PACKET_DATA_MAX) {
+			taken[taken_n - 1].data[taken[taken_n - 1].len++] = arg;
+		}
+		++rx_arg;
+	} else if (type == SIM_EV_FROM) {
+		rx_from = arg;
+	} else if (type == SIM_EV_SEQ) {
+		rx_seq = arg;
+	} else if (type == SIM_EV_CMD) {
+		rx_fetched(when);
+		rx_cmd = arg;
+		rx_arg = 0;
+		if (taking && taken_n < FRAMES_MAX) {
+			memset(&taken[taken_n], 0, sizeof(taken[taken_n]));
+			taken[taken_n].from = rx_from;
+			taken[taken_n].seq = rx_seq;
+			taken[taken_n].cmd = arg;
+			++taken_n;
+		}
+		state_apply(&st.power, &st.speed, arg, -1, 0);
+		++st.decoded;
+		if (press_pending) {
+			double latency = (when - press_at) / (F_SIM / 1000.0);
+
+			press_pending = 0;
+			++st.answered;
+			st.latency_sum += latency;
+			if (latency > st.latency_max) {
+				st.latency_max = latency;
+			}
+		}
+		if (opt.verbose) {
+			printf("%10.3f ms  rx  cmd  %02X\n", when / 1e3, arg);
+		}
+	}
+}
+
+/*
+ * boards
+ */
+
+static void board_load(struct board *b) {
+	char path[PATH_MAX + 16];
+
+	snprintf(path, sizeof(path), "%s/%s.so", dir, b->name);
+	b->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!b->handle) {
+		fprintf(stderr, "rfsim: %s\n", dlerror());
+		exit(1);
+	}
+	b->mcu = dlsym(b->handle, "sim_mcu");
+	if (!b->mcu) {
+		fprintf(stderr, "rfsim: %s\n", dlerror());
+		exit(1);
+	}
+	b->mcu->program();
+	if (b == &rx && rx_paired_valid) {
+		memcpy(b->mcu->eeprom, rx_paired, SIM_EEPROM_SIZE);
+	}
+	if (b == &tx) {
+		int i;
+
+		/* the remote has to stay ahead of the counter the receiver keeps */
+		if (rx_paired_valid) {
+			memcpy(b->mcu->eeprom + TX_EE_CTR, tx_paired_ctr, 4);
+		}
+
+		/* preamble, repeat count, gap, settle and hold, see src/tx/rftx.h */
+		for (i = 0; i < 5; ++i) {
+			if (opt.profile[i] >= 0) {
+				b->mcu->eeprom[i < 3 ? i : TX_EE_SETTLE + i - 3] = opt.profile[i];
+			}
+		}
+	}
+	b->mcu->reset(&b->host, now);
+	if (b == &rx) {
+		b->mcu->input(RX_ZC, 0, now);	// detector output idles low
+		b->mcu->input(RX_ICP, 1, now);
+		line_n = 0;
+		line_end = 0;
+	}
+}
+
+static void board_unload(struct board *b) {
+	dlclose(b->handle);
+	b->handle = 0;
+	b->mcu = 0;
+}
+
+/* cut the power to one board, only its EEPROM survives */
+static void board_restart(struct board *b) {
+	uint8_t eeprom[SIM_EEPROM_SIZE];
+
+	memcpy(eeprom, b->mcu->eeprom, sizeof(eeprom));
+	board_unload(b);
+	board_load(b);
+	memcpy(b->mcu->eeprom, eeprom, sizeof(eeprom));
+}
+
+static void boards_power_on(void) {
+	tx.host.ctx = &tx;
+	tx.host.uart_tx = tx_uart;
+	tx.host.pin_change = tx_pin;
+	tx.host.event = tx_event;
+	rx.host.ctx = &rx;
+	rx.host.uart_tx = rx_uart;
+	rx.host.pin_change = rx_pin;
+	rx.host.event = rx_event;
+
+	now = 0;
+	rf_on = 0;
+	air_busy_until = 0;
+	air_mark_since = 0;
+	press_pending = 0;
+	press_keyed = 0;
+	zc_count = 0;
+	diag_len = 0;
+	diag_lines = 0;
+	diag_last[0] = 0;
+	soft_start = 0;
+	soft_level = 1;
+	board_load(&tx);
+	board_load(&rx);
+}
+
+static void rx_counters(uint16_t *c) {
+	void (*get)(uint16_t *) = (void (*)(uint16_t *)) dlsym(rx.handle,
+			"sim_rx_stats");
+
+	memset(c, 0, SIM_RX_STATS * sizeof(*c));
+	if (get) {
+		get(c);
+	}
+}
+
+static void boards_power_off(void) {
+	board_unload(&tx);
+	board_unload(&rx);
+}
+
+static void boards_run(uint64_t until) {
+	while (now < until) {
+		now += QUANTUM;
+		tx.mcu->run(now);
+		mains_step();
+		line_flush(now);
+		rx.mcu->run(now);
+		channel_noise();
+	}
+}
+
+/* a bouncing contact chatters for up to opt.bounce ms before it settles */
+static void key(uint8_t col, uint8_t pressed) {
+	uint64_t end = now + ms(opt.bounce);
+
+	while (now < end) {
+		tx.mcu->key(TX_KEY_ROW, col, pressed);
+		boards_run(now + ms(opt.bounce * rnd() / 4));
+		tx.mcu->key(TX_KEY_ROW, col, !pressed);
+		boards_run(now + ms(opt.bounce * rnd() / 4));
+	}
+	tx.mcu->key(TX_KEY_ROW, col, pressed);
+}
+
+/*
+ * scenarios
+ */
+
+static void power_diff(struct sim_power *d, const struct sim_power *a,
+		const struct sim_power *b) {
+	d->active = b->active - a->active;
+	d->isr = b->isr - a->isr;
+	d->idle = b->idle - a->idle;
+	d->pwr_down = b->pwr_down - a->pwr_down;
+}
+
+/* single presses cycling through the three keys */
+static void run_presses(struct stats *s) {
+	static const uint8_t cols[3] = { TX_KEY_PWR, TX_KEY_INC, TX_KEY_DEC };
+	struct sim_power boot, end, rx_boot, rx_end;
+	unsigned long i;
+
+	memset(&st, 0, sizeof(st));
+	boards_power_on();
+	boards_run(ms(100));	// let both sides boot
+	tx.mcu->power(&boot);
+	rx.mcu->power(&rx_boot);
+
+	for (i = 0; i < opt.presses; ++i) {
+		uint8_t col = cols[i % 3];
+
+		press_at = now;
+		press_pending = 1;
+		press_keyed = 1;
+		++st.presses;
+		key(col, 1);
+		boards_run(now + ms(opt.hold));
+		key(col, 0);
+		boards_run(press_at + ms(opt.period));
+		if (st.power == st.want_power && st.speed == st.want_speed) {
+			++st.synced;
+		}
+	}
+	tx.mcu->power(&end);
+	power_diff(&st.tx, &boot, &end);
+	rx.mcu->power(&rx_end);
+	power_diff(&st.rx, &rx_boot, &rx_end);
+
+	boards_power_off();
+	*s = st;
+}
+
+/* key held down, the transmitter repeats as fast as it can */
+static void run_flood(struct stats *s, double seconds) {
+	uint64_t start;
+
+	memset(&st, 0, sizeof(st));
+	boards_power_on();
+	boards_run(ms(100));
+
+	start = now;
+	key(TX_KEY_INC, 1);
+	boards_run(start + ms(seconds * 1000));
+	key(TX_KEY_INC, 0);
+	boards_run(now + ms(500));	// whatever is left after the release
+	st.overruns = rx.mcu->uart_overruns();
+	rx_counters(st.counters);
+
+	boards_power_off();
+	*s = st;
+}
+
+/* change the state, let the receiver lose power and see what it restores */
+static void run_restore(void) {
+	static const uint8_t cols[6] = {
+		TX_KEY_PWR, TX_KEY_INC, TX_KEY_INC, TX_KEY_INC, TX_KEY_DEC, TX_KEY_INC
+	};
+	uint8_t duty[8];
+	double delay[8];
+	unsigned i;
+
+	memset(&st, 0, sizeof(st));
+	boards_power_on();
+	boards_run(ms(100));
+
+	for (i = 0; i < sizeof(cols); ++i) {
+		key(cols[i], 1);
+		boards_run(now + ms(opt.hold));
+		key(cols[i], 0);
+		boards_run(now + ms(opt.period));
+	}
+	boards_run(now + ms(3000));	// long enough for the deferred save
+
+	st.restored = 0;
+	board_restart(&rx);
+	boards_run(now + ms(10));	// boot
+	printf("receiver power cycle: %s power %d speed %d, commands sent add up "
+			"to power %d speed %d\n", st.restored ? "restored" : "nothing saved,",
+			st.power, st.speed, st.want_power, st.want_speed);
+
+	/* the output soft-starts to the restored speed */
+	st.gates = 0;
+	for (i = 0; i < 8; ++i) {
+		duty[i] = rx.mcu->pwm(RX_SPEED);
+		delay[i] = st.gates ? st.gate_delay : 0;
+		boards_run(now + ms(100));
+	}
+	if (st.gates) {
+		printf("triac gate after power-up:");
+		for (i = 0; i < 8; ++i) {
+			printf(delay[i] ? " %5.0f" : "   off", delay[i]);
+		}
+		printf(" us (every 100 ms)\n");
+	} else {
+		printf("speed output after power-up:");
+		for (i = 0; i < 8; ++i) {
+			printf(" %3.0f%%", 100.0 * duty[i] / 255);
+		}
+		printf(" (every 100 ms)\n");
+	}
+
+	boards_power_off();
+}
+
+static void tap(uint8_t col) {
+	key(col, 1);
+	boards_run(now + ms(opt.hold));
+	key(col, 0);
+	boards_run(now + ms(opt.period));
+}
+
+static void set_tx_id(uint16_t id) {
+	board_restart(&tx);
+	tx.mcu->eeprom[TX_EE_ID] = id & 0xFF;
+	tx.mcu->eeprom[TX_EE_ID + 1] = id >> 8;
+	tx_from = id & 0xFF;
+}
+
+/* pair the receiver by holding the power key, then check that it ignores
+ * another remote, the paired EEPROM is kept for the other scenarios */
+static void run_pairing(void) {
+	unsigned long sent, decoded;
+	int i;
+
+	memset(&st, 0, sizeof(st));
+	rx_paired_valid = 0;
+	boards_power_on();
+	boards_run(ms(100));
+
+	tap(TX_KEY_INC);
+	tap(TX_KEY_INC);
+	printf("pairing: unpaired receiver decoded %lu of %lu commands", st.decoded,
+			st.sent);
+
+	key(TX_KEY_PWR, 1);
+	boards_run(now + ms(PAIR_HOLD_MS + 500));
+	key(TX_KEY_PWR, 0);
+	boards_run(now + ms(3000));	// the counters reach the log with the deferred save
+	memcpy(rx_paired, rx.mcu->eeprom, SIM_EEPROM_SIZE);
+	memcpy(tx_paired_ctr, tx.mcu->eeprom + TX_EE_CTR, 4);
+	rx_paired_valid = 1;
+
+	sent = st.sent;
+	decoded = st.decoded;
+	for (i = 0; i < 10; ++i) {
+		tap(TX_KEY_INC);
+	}
+	printf(", after holding power %.1f s %lu of %lu\n",
+			(PAIR_HOLD_MS + 500) / 1000.0, st.decoded - decoded, st.sent - sent);
+
+	/* a second remote pairs, then changes the speed after the first one
+	 * switched the fan, the receiver has to end up where the commands of
+	 * both lead, counted from the state it is in once both are paired */
+	set_tx_id(0x2B2B);
+	key(TX_KEY_PWR, 1);
+	boards_run(now + ms(PAIR_HOLD_MS + 500));
+	key(TX_KEY_PWR, 0);
+	boards_run(now + ms(opt.period));
+	set_tx_id(TX_ID);
+	st.want_power = st.power;
+	st.want_speed = st.speed;
+	tap(TX_KEY_PWR);
+	tap(TX_KEY_INC);
+	set_tx_id(0x2B2B);
+	tap(TX_KEY_DEC);
+	tap(TX_KEY_DEC);
+	printf("second remote: receiver at power %d speed %d, the commands of both "
+			"add up to power %d speed %d\n", st.power, st.speed,
+			st.want_power, st.want_speed);
+
+	/* a remote paired with some other receiver */
+	set_tx_id(0x5A5A);
+	sent = st.sent;
+	decoded = st.decoded;
+	for (i = 0; i < 10; ++i) {
+		tap(TX_KEY_INC);
+	}
+	printf("foreign remote: %lu of %lu commands decoded\n",
+			st.decoded - decoded, st.sent - sent);
+
+	/* pairing closes 30 s after power-up */
+	boards_run(ms(31000));
+	key(TX_KEY_PWR, 1);
+	boards_run(now + ms(PAIR_HOLD_MS + 500));
+	key(TX_KEY_PWR, 0);
+	boards_run(now + ms(opt.period));
+	sent = st.sent;
+	decoded = st.decoded;
+	tap(TX_KEY_INC);
+	printf("held power after the pairing window: %lu of %lu commands decoded"
+			"\n\n", st.decoded - decoded, st.sent - sent);
+
+	boards_power_off();
+}
+
+/* play the captured bytes back to the receiver, returns the commands it
+ * took from them */
+static unsigned long replay(void) {
+	unsigned long decoded = st.decoded;
+	double bit = rx.mcu->uart_bit();
+	uint64_t start = now;
+	unsigned i;
+
+	/* back to back, the line gets each byte a little ahead of time */
+	for (i = 0; i < capture_n; ++i) {
+		uint8_t bits[10];
+
+		boards_run(start + (uint64_t) (i * 10 * bit));
+		rx.mcu->uart_rx(capture[i].data, 0,
+				start + (uint64_t) ((i + 1) * 10 * bit));
+		frame_bits(bits, capture[i].data, 1);
+		line_send(bits, start + (uint64_t) ((i * 10 + 0.5) * bit), bit, 0);
+	}
+	boards_run(now + ms(opt.period));
+	return st.decoded - decoded;
+}
+
+/* Dallas/Maxim CRC-8 of the packets, see src/rx/crc8.h */
+static uint8_t crc8(const uint8_t *buf, unsigned len) {
+	uint8_t crc = 0;
+	int i;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; ++i) {
+			crc = (crc & 1) ? (crc >> 1) ^ 0x8C : crc >> 1;
+		}
+	}
+	return crc;
+}
+
+/* turn every copy in capture[] into a packet from the same remote that is
+ * ahead by the given number of sequence steps, with a good checksum but a
+ * wrong MAC, works on uncoded packets only */
+static void forge(uint8_t ahead) {
+	uint8_t f[PACKET_DATA_MAX + MAC_SIZE + 8];
+	unsigned i, j, n;
+
+	for (i = 0; i + 5 < capture_n; ++i) {
+		if (capture[i].data != PACKET_HEAD || capture[i + 1].data != PACKET_SIGN) {
+			continue;
+		}
+		n = capture[i + 4].data + MAC_SIZE + 6;	// up to the CRC
+		if (capture[i + 4].data > PACKET_DATA_MAX + 1 || i + n >= capture_n) {
+			continue;
+		}
+		for (j = 0; j < n; ++j) {
+			f[j] = capture[i + j].data;
+		}
+		f[5] += ahead;
+		f[n - 1] ^= 0x01;	// last MAC byte
+		f[n] = crc8(f, n);
+		for (j = 0; j <= n; ++j) {
+			capture[i + j].data = f[j];
+		}
+		i += n;
+	}
+}
+
+static void set_tx_ctr(uint32_t ctr) {
+	int i;
+
+	board_restart(&tx);
+	for (i = 0; i < 4; ++i) {
+		tx.mcu->eeprom[TX_EE_CTR + i] = ctr >> (8 * i);
+	}
+}
+
+/* record a key press off the air and play it back once the receiver has
+ * moved on and once more after it lost power before its deferred save of
+ * the state. With AUTH_SPECK count the presses the receiver refuses after
+ * that power cut, as its counters skipped ahead. Then send a forged packet
+ * that claims to be ahead of the remote, then let the remote run far ahead
+ * of the receiver and resync it. */
+static void run_replay(void) {
+	unsigned long now_n, cycled_n, lost_n, forged_n, after_n, ahead_n,
+			resync_n;
+	uint32_t ctr = 0;
+	int i;
+
+	memset(&st, 0, sizeof(st));
+	boards_power_on();
+	boards_run(ms(100));
+
+	capture_n = 0;
+	capture_on = 1;
+	tap(TX_KEY_INC);
+	capture_on = 0;
+	tap(TX_KEY_DEC);
+	now_n = replay();
+
+	boards_run(now + ms(500));	// well before the deferred save
+	board_restart(&rx);
+	boards_run(now + ms(10));
+	cycled_n = replay();
+	printf("replayed key press (%u bytes): %lu commands taken right away, %lu "
+			"after a receiver power cycle\n", capture_n, now_n, cycled_n);
+
+	if (!st.tx_blocks) {
+		boards_power_off();
+		return;
+	}
+
+	for (lost_n = 0; lost_n < 64; ++lost_n) {
+		after_n = st.decoded;
+		tap(TX_KEY_INC);
+		if (st.decoded != after_n) {
+			break;
+		}
+	}
+	printf("power cut before the deferred save: the next %lu presses refused"
+			"\n", lost_n);
+
+	/* a bad MAC must not move the repeat filter on */
+	forge(8);
+	forged_n = replay();
+	after_n = st.decoded;
+	tap(TX_KEY_INC);
+	after_n = st.decoded - after_n;
+	printf("forged packet 8 ahead with a bad MAC: %lu commands taken, then %lu "
+			"of 1 from the remote\n", forged_n, after_n);
+
+	for (i = 0; i < 4; ++i) {
+		ctr |= (uint32_t) tx.mcu->eeprom[TX_EE_CTR + i] << (8 * i);
+	}
+	set_tx_ctr(ctr + 1000);
+	boards_run(now + ms(10));
+	ahead_n = st.decoded;
+	tap(TX_KEY_INC);
+	ahead_n = st.decoded - ahead_n;
+	key(TX_KEY_PWR, 1);
+	boards_run(now + ms(PAIR_HOLD_MS + 500));
+	key(TX_KEY_PWR, 0);
+	boards_run(now + ms(opt.period));
+	resync_n = st.decoded;
+	tap(TX_KEY_INC);
+	resync_n = st.decoded - resync_n;
+	printf("remote 1000 counts ahead: %lu of 1 commands taken, after holding "
+			"power %lu of 1\n", ahead_n, resync_n);
+
+	boards_power_off();
+}
+
+/* key repeats with the telemetry port running, once on the software UART
+ * and once on the hardware one, prints nothing for a receiver built
+ * without DIAG */
+static void run_telemetry(void) {
+	static const char *const port[2] = { "PD4 at 2400 baud", "TXD (jumper)" };
+	int hw;
+
+	for (hw = 0; hw < 2; ++hw) {
+		memset(&st, 0, sizeof(st));
+		boards_power_on();
+		if (hw) {
+			rx.mcu->input(RX_DIAG_JMP, 0, now);
+		}
+		boards_run(ms(100));
+		if (!diag_len && !diag_lines) {
+			boards_power_off();
+			return;
+		}
+
+		key(TX_KEY_INC, 1);
+		boards_run(now + ms(3000));
+		key(TX_KEY_INC, 0);
+		boards_run(now + ms(1500));
+		soft_advance(now);
+		printf("%stelemetry on %s: %lu lines, %lu of %lu commands decoded, "
+				"last:\n  %s\n", hw ? "" : "\n", port[hw], diag_lines,
+				st.decoded, st.sent, diag_last);
+
+		boards_power_off();
+	}
+}
+
+/* walk through the speed levels and time the triac gate pulses, prints
+ * nothing for a receiver built with the PWM output */
+static void run_triac(void) {
+	double half = 1000.0 / (2.0 * opt.mains);
+	unsigned long gates;
+	int i;
+
+	if (opt.mains <= 0) {
+		return;
+	}
+	memset(&st, 0, sizeof(st));
+	boards_power_on();
+	boards_run(ms(100));
+
+	tap(TX_KEY_PWR);
+	if (!st.power) {
+		tap(TX_KEY_PWR);	// the remote thought it was on
+	}
+	for (i = 0; i <= SPEED_MAX; ++i) {
+		boards_run(now + ms(1200));	// ramp
+		gates = st.gates;
+		boards_run(now + ms(100 * half));
+		if (!st.gates) {
+			boards_power_off();
+			return;
+		}
+		if (i == 0) {
+			printf("\ntriac gate at %.0f Hz, delay after the zero cross:\n",
+					opt.mains);
+		}
+		printf("  speed %d: %5.0f us %4.0f deg, %3.0f us pulse, %lu of 100 half"
+				" cycles\n", st.speed, st.gate_delay,
+				180.0 * st.gate_delay / (half * 1000.0), st.gate_width,
+				st.gates - gates);
+		tap(TX_KEY_INC);
+	}
+	printf("  %lu commands sent, %lu decoded\n", st.sent, st.decoded);
+
+	boards_power_off();
+}
+
+/*
+ * decode benchmark
+ */
+
+static struct {
+	uint8_t data;
+	uint8_t fe;
+	double idle;		// mark bits in front of the start bit
+} stream[STREAM_MAX];	// bytes of the scenario being played
+static unsigned stream_n;
+static struct frame expect[FRAMES_MAX];	// commands the scenario carries
+static unsigned expect_n;
+static struct {
+	unsigned first;		// in capture[]
+	unsigned n;
+	double idle;
+} burst[FRAMES_MAX];	// one key press each, in the order of sent[]
+static unsigned burst_n;
+static unsigned flood_first;	// bytes and commands of the held key
+static unsigned flood_sent;
+static unsigned copies;			// of each packet in the corpus
+static uint8_t remote_eeprom[2][SIM_EEPROM_SIZE];	// of either remote
+static int remote = -1;			// the one in the transmitter board
+
+struct bench_stats {
+	unsigned long bytes;
+	unsigned long packets;
+	unsigned long decoded;	// commands taken once and as sent
+	unsigned long bad;		// commands never sent, or taken twice
+	double isr;				// cycles the simulator charges to interrupts, a proxy
+};
+
+/* mark bits between two bytes in capture[], long pauses are cut to the
+ * press period */
+static double capture_idle(unsigned i) {
+	double idle;
+
+	if (i == 0) {
+		return 0.0;
+	}
+	idle = (capture[i].start - capture[i - 1].start) / st.bit - 10;
+	if (idle < 0) {
+		return 0.0;
+	}
+	return fmin(idle, ms(opt.period) / st.bit);
+}
+
+static void stream_byte(uint8_t data, uint8_t fe, double idle) {
+	if (stream_n < STREAM_MAX) {
+		stream[stream_n].data = data;
+		stream[stream_n].fe = fe;
+		stream[stream_n].idle = idle;
+		++stream_n;
+	}
+}
+
+/* the first n bytes of a key press, as they went out */
+static void stream_burst(unsigned b, unsigned n, double idle) {
+	unsigned i;
+
+	for (i = 0; i < n && i < burst[b].n; ++i) {
+		stream_byte(capture[burst[b].first + i].data, 0,
+				i ? capture_idle(burst[b].first + i) : idle);
+	}
+}
+
+/* garbage the way the receiver sees it, half of it without a stop bit */
+static void stream_noise(unsigned n, double idle) {
+	unsigned i;
+
+	for (i = 0; i < n; ++i) {
+		uint8_t fe = rnd() < 0.5;
+
+		stream_byte(random() & 0xFF, fe, i ? 0.0 : idle);
+	}
+}
+
+static void stream_expect(unsigned b) {
+	if (expect_n < FRAMES_MAX) {
+		expect[expect_n++] = sent[b];
+	}
+}
+
+static int frame_match(const struct frame *a, const struct frame *b) {
+	return a->from == b->from && a->cmd == b->cmd && a->len == b->len
+			&& !memcmp(a->data, b->data, a->len);
+}
+
+static void frame_trace(const char *what, const struct frame *f) {
+	uint8_t i;
+
+	if (!opt.verbose) {
+		return;
+	}
+	printf("  %s: from %02X seq %02X cmd %02X", what, f->from, f->seq, f->cmd);
+	for (i = 0; i < f->len; ++i) {
+		printf(" %02X", f->data[i]);
+	}
+	printf("\n");
+}
+
+/* play the scenario to a receiver that just came up paired with both
+ * remotes and hold what it took against what was sent. The interrupts the
+ * receiver takes while the line is quiet, timer ticks and the like, are
+ * measured first and not charged to the bytes. */
+static void bench_play(const char *name, struct bench_stats *total) {
+	struct sim_power boot, quiet, end;
+	uint8_t used[FRAMES_MAX];
+	struct bench_stats s;
+	double bit, idle_rate;
+	uint64_t t, from;
+	unsigned i, j;
+
+	board_unload(&rx);
+	board_load(&rx);
+	boards_run(now + ms(100));
+	bit = rx.mcu->uart_bit();
+	rx.mcu->power(&boot);
+	from = now;
+	boards_run(now + ms(1000));
+	rx.mcu->power(&quiet);
+	idle_rate = (double) (quiet.isr - boot.isr) / (now - from);
+	taken_n = 0;
+	taking = 1;
+
+	from = now;
+	t = now + (uint64_t) bit;
+	for (i = 0; i < stream_n; ++i) {
+		uint8_t bits[10];
+		uint64_t start = t + (uint64_t) (stream[i].idle * bit);
+
+		boards_run(start - (uint64_t) (bit / 2));
+		rx.mcu->uart_rx(stream[i].data, stream[i].fe,
+				start + (uint64_t) (9.5 * bit));
+		frame_bits(bits, stream[i].data, !stream[i].fe);
+		line_send(bits, start, bit, 0);
+		t = start + (uint64_t) (10 * bit);
+	}
+	boards_run(t + ms(opt.period));
+	taking = 0;
+	rx.mcu->power(&end);
+
+	memset(&s, 0, sizeof(s));
+	memset(used, 0, sizeof(used));
+	s.bytes = stream_n;
+	s.packets = expect_n;
+	s.isr = (end.isr - quiet.isr) - idle_rate * (now - from);
+	for (i = 0; i < taken_n; ++i) {
+		for (j = 0; j < i; ++j) {
+			if (taken[j].from == taken[i].from && taken[j].seq == taken[i].seq) {
+				break;
+			}
+		}
+		if (j < i) {
+			++s.bad;	// the same packet twice
+			frame_trace("twice", &taken[i]);
+			continue;
+		}
+		for (j = 0; j < expect_n; ++j) {
+			if (!used[j] && frame_match(&taken[i], &expect[j])) {
+				break;
+			}
+		}
+		if (j < expect_n) {
+			used[j] = 1;
+			++s.decoded;
+		} else {
+			++s.bad;
+			frame_trace("never sent", &taken[i]);
+		}
+	}
+
+	printf("%-12s %6lu %7lu %7lu %6lu %6lu %7.1f%% %16.1f\n", name, s.bytes,
+			s.packets, s.decoded, s.bad, s.packets - s.decoded,
+			s.packets ? 100.0 * s.decoded / s.packets : 0.0,
+			s.bytes ? s.isr / s.bytes : 0.0);
+	total->bytes += s.bytes;
+	total->packets += s.packets;
+	total->decoded += s.decoded;
+	total->bad += s.bad;
+	total->isr += s.isr;
+	stream_n = 0;
+	expect_n = 0;
+}
+
+/* swap the other remote in, each keeps its own EEPROM and with it the
+ * rolling counter the receiver follows */
+static void bench_remote(int r) {
+	static const uint16_t id[2] = { BENCH_ID_1, BENCH_ID_2 };
+
+	if (remote >= 0) {
+		memcpy(remote_eeprom[remote], tx.mcu->eeprom, SIM_EEPROM_SIZE);
+	} else {
+		memcpy(remote_eeprom[0], tx.mcu->eeprom, SIM_EEPROM_SIZE);
+		memcpy(remote_eeprom[1], tx.mcu->eeprom, SIM_EEPROM_SIZE);
+	}
+	remote = r;
+	memcpy(tx.mcu->eeprom, remote_eeprom[r], SIM_EEPROM_SIZE);
+	set_tx_id(id[r]);
+	boards_run(now + ms(10));
+}
+
+static void bench_hold_power(void) {
+	key(TX_KEY_PWR, 1);
+	boards_run(now + ms(PAIR_HOLD_MS + 500));
+	key(TX_KEY_PWR, 0);
+	boards_run(now + ms(opt.period));
+}
+
+/* pair a fresh receiver with both remotes, then record key presses from
+ * each and a held key off the air */
+static void bench_record(void) {
+	static const uint8_t cols[3] = { TX_KEY_PWR, TX_KEY_INC, TX_KEY_DEC };
+	unsigned i;
+
+	memset(&st, 0, sizeof(st));
+	rx_paired_valid = 0;
+	boards_power_on();
+	boards_run(ms(100));
+	remote = -1;
+	bench_remote(0);
+	bench_hold_power();
+	bench_remote(1);
+	bench_hold_power();
+	boards_run(now + ms(3000));	// the counters reach the log with the deferred save
+	memcpy(rx_paired, rx.mcu->eeprom, SIM_EEPROM_SIZE);
+	memcpy(tx_paired_ctr, tx.mcu->eeprom + TX_EE_CTR, 4);
+	rx_paired_valid = 1;
+
+	capture_n = 0;
+	sent_n = 0;
+	capture_on = 1;
+	bench_remote(0);
+	for (i = 0; i < 2 * BENCH_TAPS; ++i) {
+		if (i == BENCH_TAPS) {
+			bench_remote(1);
+		}
+		tap(cols[i % 3]);
+	}
+	flood_first = capture_n;
+	flood_sent = sent_n;
+
+	bench_remote(0);
+	key(TX_KEY_INC, 1);
+	boards_run(now + ms(BENCH_FLOOD_MS));
+	key(TX_KEY_INC, 0);
+	boards_run(now + ms(opt.period));
+	capture_on = 0;
+	copies = opt.profile[1] > 0 ? opt.profile[1] : TX_REPEAT;
+	boards_power_off();
+}
+
+/* key presses are the stretches of bytes between the long pauses, the gap
+ * between copies is much shorter */
+static void bench_split(void) {
+	unsigned i;
+
+	burst_n = 0;
+	for (i = 0; i < flood_first; ++i) {
+		double idle = capture_idle(i);
+
+		if (i == 0 || idle > ms(opt.period / 2) / st.bit) {
+			if (burst_n == FRAMES_MAX) {
+				break;
+			}
+			burst[burst_n].first = i;
+			burst[burst_n].n = 0;
+			burst[burst_n].idle = idle;
+			++burst_n;
+		}
+		++burst[burst_n - 1].n;
+	}
+	if (burst_n != flood_sent) {
+		fprintf(stderr, "rfsim: %u key presses on air for %u commands sent\n",
+				burst_n, flood_sent);
+		exit(1);
+	}
+}
+
+/* the corpus as text, the receiver EEPROM it was recorded against, then
+ * the commands and the bytes on air with their start in cycles */
+static void bench_save(const char *path) {
+	FILE *f = fopen(path, "w");
+	unsigned i, j;
+
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	fprintf(f, "# rfsim decode benchmark corpus, written by rfsim -R and "
+			"replayed by rfsim -B\n");
+	fprintf(f, "bit %.6f\ncopies %u\nflood %u %u\n", st.bit, copies,
+			flood_first, flood_sent);
+	for (i = 0; i < SIM_EEPROM_SIZE; i += 32) {
+		fprintf(f, "eeprom %03X ", i);
+		for (j = 0; j < 32; ++j) {
+			fprintf(f, "%02X", rx_paired[i + j]);
+		}
+		fprintf(f, "\n");
+	}
+	for (i = 0; i < sent_n; ++i) {
+		fprintf(f, "sent %02X %02X %02X %u", sent[i].from, sent[i].seq,
+				sent[i].cmd, sent[i].len);
+		for (j = 0; j < sent[i].len; ++j) {
+			fprintf(f, " %02X", sent[i].data[j]);
+		}
+		fprintf(f, "\n");
+	}
+	for (i = 0; i < capture_n; ++i) {
+		fprintf(f, "byte %02X %llu\n", capture[i].data,
+				(unsigned long long) capture[i].start);
+	}
+	if (fclose(f)) {
+		perror(path);
+		exit(1);
+	}
+}
+
+static void bench_load(const char *path) {
+	FILE *f = fopen(path, "r");
+	char line[128];
+	unsigned n = 0;
+
+	if (!f) {
+		perror(path);
+		fprintf(stderr, "rfsim: record a corpus with -R first\n");
+		exit(1);
+	}
+	capture_n = 0;
+	sent_n = 0;
+	while (fgets(line, sizeof(line), f)) {
+		unsigned a, b, c, d[PACKET_DATA_MAX + 1], i;
+		unsigned long long t;
+		char key[16], hex[65];
+		int ok;
+
+		++n;
+		if (sscanf(line, "%15s", key) != 1 || key[0] == '#') {
+			continue;
+		}
+		if (!strcmp(key, "bit")) {
+			ok = sscanf(line, "bit %lf", &st.bit) == 1;
+		} else if (!strcmp(key, "copies")) {
+			ok = sscanf(line, "copies %u", &copies) == 1;
+		} else if (!strcmp(key, "flood")) {
+			ok = sscanf(line, "flood %u %u", &flood_first, &flood_sent) == 2;
+		} else if (!strcmp(key, "eeprom")) {
+			ok = sscanf(line, "eeprom %x %64s", &a, hex) == 2
+					&& strlen(hex) == 64;
+			ok = ok && a <= SIM_EEPROM_SIZE - 32;
+			for (i = 0; ok && i < 32; ++i) {
+				ok = sscanf(hex + 2 * i, "%2x", &b) == 1;
+				rx_paired[a + i] = b;
+			}
+		} else if (!strcmp(key, "sent")) {
+			/* as many payload bytes as the length says */
+			i = sscanf(line, "sent %x %x %x %u %x %x %x %x", &a, &b, &c,
+					&d[0], &d[1], &d[2], &d[3], &d[4]);
+			ok = i >= 4 && d[0] <= PACKET_DATA_MAX && i == 4 + d[0]
+					&& sent_n < FRAMES_MAX;
+			if (ok) {
+				sent[sent_n].from = a;
+				sent[sent_n].seq = b;
+				sent[sent_n].cmd = c;
+				sent[sent_n].len = d[0];
+				for (i = 0; i < d[0]; ++i) {
+					sent[sent_n].data[i] = d[1 + i];
+				}
+				++sent_n;
+			}
+		} else if (!strcmp(key, "byte")) {
+			ok = sscanf(line, "byte %x %llu", &a, &t) == 2
+					&& capture_n < CAPTURE_MAX;
+			if (ok) {
+				capture[capture_n].data = a;
+				capture[capture_n].start = t;
+				++capture_n;
+			}
+		} else {
+			ok = 0;
+		}
+		if (!ok) {
+			fprintf(stderr, "%s:%u: bad corpus line\n", path, n);
+			exit(1);
+		}
+	}
+	fclose(f);
+	if (!st.bit || !copies || flood_first > capture_n || flood_sent > sent_n) {
+		fprintf(stderr, "%s: incomplete corpus\n", path);
+		exit(1);
+	}
+	rx_paired_valid = 1;
+}
+
+/* replay a corpus recorded from two remotes through the receiver, every
+ * scenario starts from the same paired state. The corpus is read from
+ * opt.corpus, or recorded from the firmware into opt.record instead. */
+/* returns non-zero if the decoder took a command that was never sent or
+ * delivered less than opt.least percent of them */
+static int run_bench(void) {
+	struct bench_stats total;
+	double rate;
+	unsigned b, i;
+
+	if (opt.record) {
+		bench_record();
+		bench_save(opt.record);
+		printf("decode benchmark: %u bytes, %u commands written to %s\n",
+				capture_n, sent_n, opt.record);
+		return 0;
+	}
+	bench_load(opt.corpus);
+	bench_split();
+	boards_power_on();
+
+	printf("decode benchmark: %u bytes from remotes %04X and %04X, %u commands"
+			" from %s\n\n", capture_n, BENCH_ID_1, BENCH_ID_2, sent_n,
+			opt.corpus);
+	printf("%-12s %6s %7s %7s %6s %6s %8s %16s\n", "scenario", "bytes",
+			"packets", "decoded", "false", "missed", "rate", "I/O+ISR cyc/byte");
+	memset(&total, 0, sizeof(total));
+
+	/* presses as recorded */
+	for (b = 0; b < burst_n; ++b) {
+		stream_burst(b, burst[b].n, burst[b].idle);
+		stream_expect(b);
+	}
+	bench_play("clean", &total);
+
+	/* bursts of garbage in the pauses and cutting into either half of a
+	 * press, about one copy each */
+	for (b = 0; b < burst_n; ++b) {
+		unsigned half = burst[b].n / 2;
+		unsigned cut[2];
+		double idle = burst[b].idle;
+
+		if (rnd() < 0.5) {
+			stream_noise(1 + random() % 16, idle);	// late in the pause
+			idle = 20 * rnd();
+		}
+		cut[0] = rnd() < 0.5 ? 1 + random() % (half - 1) : 0;
+		cut[1] = rnd() < 0.5 ? half + random() % (burst[b].n - half) : 0;
+		for (i = 0; i < burst[b].n; ++i) {
+			if (i && (i == cut[0] || i == cut[1])) {
+				stream_noise(1 + random() % 4, 0.0);
+			}
+			stream_byte(capture[burst[b].first + i].data, 0,
+					i ? capture_idle(burst[b].first + i) : idle);
+		}
+		stream_expect(b);
+	}
+	bench_play("noise", &total);
+
+	/* the start of some other press right in front of each one, cut off
+	 * before its first copy is complete */
+	for (b = 0; b < burst_n; ++b) {
+		unsigned o = (b + 1 + random() % (burst_n - 1)) % burst_n;
+		unsigned most = burst[o].n / copies;
+
+		stream_burst(o, 2 + random() % (most > 2 ? most - 2 : 1),
+				burst[b].idle);
+		stream_burst(b, burst[b].n, 0.0);
+		stream_expect(b);
+	}
+	bench_play("partial", &total);
+
+	/* the held key, back to back repeats */
+	for (i = flood_first; i < capture_n; ++i) {
+		stream_byte(capture[i].data, 0, capture_idle(i));
+	}
+	for (i = flood_sent; i < sent_n; ++i) {
+		stream_expect(i);
+	}
+	bench_play("flood", &total);
+
+	/* the two remotes taking turns without a pause */
+	for (b = 0; b < BENCH_TAPS; ++b) {
+		stream_burst(b, burst[b].n, burst[b].idle);
+		stream_burst(BENCH_TAPS + b, burst[BENCH_TAPS + b].n, 0.0);
+		stream_expect(b);
+		stream_expect(BENCH_TAPS + b);
+	}
+	bench_play("two remotes", &total);
+
+	rate = 100.0 * total.decoded / total.packets;
+	printf("%-12s %6lu %7lu %7lu %6lu %6lu %7.1f%% %16.1f\n", "total",
+			total.bytes, total.packets, total.decoded, total.bad,
+			total.packets - total.decoded, rate, total.isr / total.bytes);
+
+	boards_power_off();
+
+	if (total.bad) {
+		fprintf(stderr, "rfsim: %lu commands taken that were never sent, or "
+				"twice\n", total.bad);
+		return 1;
+	}
+	if (rate < opt.least) {
+		fprintf(stderr, "rfsim: %.1f%% of the commands decoded, less than %.1f%%"
+				"\n", rate, opt.least);
+		return 1;
+	}
+	return 0;
+}
+
+/* where the frames went according to the receiver */
+static void report_counters(const struct stats *s) {
+	const uint16_t *c = s->counters;
+
+	printf("receiver counted %u good frames (%u voted, %u repeats, %u queue "
+			"full, %u bad MAC), %u bad CRC, %u given up, %u framing errors, %u "
+			"overruns\n", c[SIM_RX_FRAMES], c[SIM_RX_VOTED], c[SIM_RX_REPEATS],
+			c[SIM_RX_DROPS], c[SIM_RX_MAC], c[SIM_RX_CRC], c[SIM_RX_RESYNC],
+			c[SIM_RX_FE], c[SIM_RX_DOR]);
+}
+
+/* receiver time spent per packet against the time the packets take on air.
+ * The cipher part of it is SIM_SPECK_CYCLES, an unmeasured guess, so this
+ * cannot tell whether the MAC check keeps up on real hardware. */
+static void report_auth(const struct stats *s) {
+	double air = s->sent ? s->bytes * 10 * s->bit / s->sent / (F_SIM / 1000.0)
+			: 0.0;
+
+	if (!s->rx_blocks) {
+		return;
+	}
+	printf("MAC check: %.1f blocks a packet, rx_getcmd() %.2f ms mean %.2f ms "
+			"max with guessed cipher cycles, a command is on air for %.2f ms, %lu of %lu packets "
+			"rejected, %lu UART overruns\n",
+			(double) s->rx_blocks / s->fetched, s->fetch_sum / s->fetched,
+			s->fetch_max, air, s->rejected, s->fetched, s->overruns);
+}
+
+static void report_header(void) {
+	printf("%9s %7s %7s %7s %8s %10s %10s %8s\n", "BER", "presses", "sent",
+			"decoded", "success", "lat mean", "lat max", "in sync");
+}
+
+static void report(double ber, const struct stats *s) {
+	printf("%9.1e %7lu %7lu %7lu %7.1f%% %7.1f ms %7.1f ms %7.1f%%\n", ber,
+			s->presses, s->sent, s->decoded,
+			s->presses ? 100.0 * s->answered / s->presses : 0.0,
+			s->answered ? s->latency_sum / s->answered : 0.0,
+			s->latency_max,
+			s->presses ? 100.0 * s->synced / s->presses : 0.0);
+}
+
+/* charge per key press and projected battery life of the transmitter */
+static void report_power(const struct stats *s) {
+	double n = s->presses ? s->presses : 1;
+	double active = s->tx.active / n / (F_SIM / 1000.0);
+	double isr = s->tx.isr / n / (F_SIM / 1000.0);
+	double idle = s->tx.idle / n / (F_SIM / 1000.0);
+	double rf = s->rf_on / n / (F_SIM / 1000.0);
+	double settle = s->rf_settle / n / (F_SIM / 1000.0);
+	double press = (active * I_ACTIVE + idle * I_IDLE + rf * I_RF) / 3600e3;
+	double standby = I_PWR_DOWN * 24.0;
+	double day = opt.daily * press + standby;
+	double rx_total = s->rx.active + s->rx.idle + s->rx.pwr_down;
+
+	printf("\ntransmitter power budget per key press (BER 0):\n"
+			"  MCU active   %8.2f ms  (%.2f ms in interrupts) at %.2f mA\n"
+			"  MCU idle     %8.2f ms  at %.2f mA\n"
+			"  RF module on %8.2f ms  (%.2f ms settling) at %.2f mA\n"
+			"  key to air   %8.2f ms  (%.2f ms max)\n"
+			"  charge       %8.3f uAh per command\n",
+			active, isr, I_ACTIVE, idle, I_IDLE, rf, settle, I_RF,
+			s->keyed ? s->first_sum / s->keyed : 0.0, s->first_max, press * 1e3);
+	printf("  standby      %8.3f uAh per day at %.4f mA\n"
+			"  %.0f presses a day: %.3f mAh a day, %.0f days on %.0f mAh\n",
+			standby * 1e3, I_PWR_DOWN, opt.daily, day, opt.capacity / day,
+			opt.capacity);
+	printf("\nreceiver: %.1f%% active (%.1f%% in interrupts), %.1f%% idle, "
+			"%.3f mA average\n", 100.0 * s->rx.active / rx_total,
+			100.0 * s->rx.isr / rx_total, 100.0 * s->rx.idle / rx_total,
+			(s->rx.active * I_ACTIVE + s->rx.idle * I_IDLE
+					+ s->rx.pwr_down * I_PWR_DOWN) / rx_total);
+}
+
+static void usage(void) {
+	fprintf(stderr,
+			"usage: rfsim [options]\n"
+			"  -b ber     bit error rate, default sweeps 0 to 3e-2\n"
+			"  -a rate    error rate of bits past %d equal ones (AGC drift, 0)\n"
+			"  -n rate    noise bytes per second while the air is idle (0)\n"
+			"  -k pct     transmitter clock error in percent (0)\n"
+			"  -s ms      RF module settle time (2)\n"
+			"  -o ms      key contact bounce (0)\n"
+			"  -h ms      key press length (20)\n"
+			"  -p ms      time between key presses (400)\n"
+			"  -c count   number of key presses (200)\n"
+			"  -d count   key presses per day for the battery model (50)\n"
+			"  -m mAh     battery capacity (220, a CR2032)\n"
+			"  -z hz      mains frequency at the zero-cross detector (50), 0 for none\n"
+			"  -t p,r,g[,s[,h]]\n"
+			"             transmit profile: preamble bytes, copies, gap, RF settle\n"
+			"             and RF hold in ms\n"
+			"  -r seed    random seed (1)\n"
+			"  -v         trace every command\n"
+			"  -B         only run the decode benchmark on a recorded corpus, exits\n"
+			"             with 1 on a false command or low delivery. Its last\n"
+			"             column is a proxy, only the register accesses and\n"
+			"             interrupt entries the simulator charges, not AVR cycles\n"
+			"  -C file    corpus the benchmark replays (bench.corpus)\n"
+			"  -R file    record a corpus from the firmware into file instead, it\n"
+			"             only replays to a receiver built the same way\n"
+			"  -l pct     lowest delivery rate the benchmark passes with (85)\n",
+			AGC_RUN);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	static const double sweep[] = { 0, 1e-4, 3e-4, 1e-3, 3e-3, 1e-2, 3e-2 };
+	struct stats s, quiet;
+	char self[PATH_MAX];
+	ssize_t n;
+	unsigned i;
+	int c;
+
+	while ((c = getopt(argc, argv, "b:a:n:k:s:o:h:p:c:d:m:z:t:r:vBC:R:l:")) != -1) {
+		switch (c) {
+		case 'b':
+			opt.ber = atof(optarg);
+			break;
+		case 'a':
+			opt.agc = atof(optarg);
+			break;
+		case 'n':
+			opt.noise = atof(optarg);
+			break;
+		case 'k':
+			opt.skew = atof(optarg);
+			break;
+		case 's':
+			opt.settle = atof(optarg);
+			break;
+		case 'o':
+			opt.bounce = atof(optarg);
+			break;
+		case 'h':
+			opt.hold = atof(optarg);
+			break;
+		case 'p':
+			opt.period = atof(optarg);
+			break;
+		case 'c':
+			opt.presses = strtoul(optarg, 0, 0);
+			break;
+		case 'd':
+			opt.daily = atof(optarg);
+			break;
+		case 'm':
+			opt.capacity = atof(optarg);
+			break;
+		case 'z':
+			opt.mains = atof(optarg);
+			break;
+		case 't':
+			if (sscanf(optarg, "%d,%d,%d,%d,%d", &opt.profile[0],
+					&opt.profile[1], &opt.profile[2], &opt.profile[3],
+					&opt.profile[4]) < 3) {
+				usage();
+			}
+			break;
+		case 'r':
+			opt.seed = strtoul(optarg, 0, 0);
+			break;
+		case 'v':
+			opt.verbose = 1;
+			break;
+		case 'B':
+			opt.bench = 1;
+			break;
+		case 'C':
+			opt.corpus = optarg;
+			break;
+		case 'R':
+			opt.bench = 1;
+			opt.record = optarg;
+			break;
+		case 'l':
+			opt.least = atof(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	/* firmware images live next to the executable */
+	n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (n < 0) {
+		perror("rfsim");
+		return 1;
+	}
+	self[n] = 0;
+	snprintf(dir, sizeof(dir), "%s", dirname(self));
+
+	srandom(opt.seed);
+	if (opt.bench) {
+		return run_bench();
+	}
+	printf("rfsim: %lu presses, %.0f ms hold, %.0f ms period, settle %.1f ms,"
+			" bounce %.0f ms, noise %.0f/s, skew %+.1f%%, agc %.2g\n\n",
+			opt.presses, opt.hold, opt.period, opt.settle, opt.bounce, opt.noise,
+			opt.skew, opt.agc);
+
+	run_pairing();
+
+	report_header();
+	if (opt.ber >= 0) {
+		run_presses(&s);
+		report(opt.ber, &s);
+		quiet = s;
+	} else {
+		for (i = 0; i < sizeof(sweep) / sizeof(sweep[0]); ++i) {
+			opt.ber = sweep[i];
+			run_presses(&s);
+			report(opt.ber, &s);
+			if (i == 0) {
+				quiet = s;
+			}
+		}
+		opt.ber = 0;
+	}
+
+	run_flood(&s, 5.0);
+	printf("\nkey held for 5 s: %lu sent, %lu decoded, %.1f packets/s, "
+			"%lu bytes on air, speed %d\n", s.sent, s.decoded, s.decoded / 5.0,
+			s.bytes, s.speed);
+	report_counters(&s);
+	report_auth(&s);
+	run_flood(&s, 0.85);
+	printf("key held for 0.85 s: %lu sent, %lu decoded, %lu bytes on air, "
+			"speed %d\n", s.sent, s.decoded, s.bytes, s.speed);
+	report_power(&quiet);
+	printf("\n");
+	run_restore();
+	run_replay();
+	run_telemetry();
+	run_triac();
+
+	return 0;
+}
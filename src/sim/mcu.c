@@ -0,0 +1,1272 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * mcu.c
+ *
+ * Fake ATmega8 peripheral layer. The firmware runs unmodified on its own
+ * stack and hands control back to the harness whenever its clock passes
+ * the current deadline. Only the peripherals used by the firmware are
+ * modelled: USART, EEPROM, external interrupts, the three timers, the OC1A
+ * compare output and the port pins.
+ *
+ * Register writes are detected lazily by comparing a register with the
+ * value it had when it was last handed out, so writing a register with the
+ * value it already holds goes unnoticed. This matters for UDR, where a
+ * repeated byte is told apart from a read by the state of the receiver,
+ * and for the write-one-to-clear flags TXC, TIFR and GIFR.
+ *
+ * Busy waits must touch an I/O register, a loop spinning on a RAM
+ * variable that only an ISR changes never gives the simulator control.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#include "mcu.h"
+
+#define SIM_IO_CYCLES	2		// cost of one register access
+#define SIM_ISR_CYCLES	20		// vector jump, prologue, epilogue and reti
+#define SIM_WAKE_CYCLES	6		// start-up from sleep
+
+#define SIM_STACK_SIZE	(256 * 1024)
+#define SIM_TOUCH_MAX	4
+#define SIM_RXQ_SIZE	64
+#define SIM_KEY_MAX		32
+#define SIM_INQ_SIZE	64
+
+#define IO(addr)		(io[(addr)])
+#define A_UBRRL			0x09
+#define A_UCSRB			0x0A
+#define A_UCSRA			0x0B
+#define A_UDR			0x0C
+#define A_PIND			0x10
+#define A_EECR			0x1C
+#define A_EEDR			0x1D
+#define A_EEARL			0x1E
+#define A_EEARH			0x1F
+#define A_UBRRH			0x20
+#define A_OCR2			0x23
+#define A_TCNT2			0x24
+#define A_TCCR2			0x25
+#define A_ICR1			0x26
+#define A_OCR1B			0x28
+#define A_OCR1A			0x2A
+#define A_TCNT1			0x2C
+#define A_TCCR1B		0x2E
+#define A_TCCR1A		0x2F
+#define A_SFIOR			0x30
+#define A_TCNT0			0x32
+#define A_TCCR0			0x33
+#define A_MCUCR			0x35
+#define A_TIFR			0x38
+#define A_TIMSK			0x39
+#define A_GIFR			0x3A
+#define A_GICR			0x3B
+#define A_SREG			0x3F
+
+/* sleep modes as encoded in MCUCR SM2:0 */
+#define AWAKE			0xFF
+#define MODE_IDLE		0
+#define MODE_ADC		1
+#define MODE_PWR_DOWN	2
+#define MODE_PWR_SAVE	3
+#define MODE_STANDBY	6
+
+#define VECTOR_DECLARE(n)	extern void __vector_ ## n(void) __attribute__((weak))
+VECTOR_DECLARE(1); VECTOR_DECLARE(2); VECTOR_DECLARE(3); VECTOR_DECLARE(4);
+VECTOR_DECLARE(5); VECTOR_DECLARE(6); VECTOR_DECLARE(7); VECTOR_DECLARE(8);
+VECTOR_DECLARE(9); VECTOR_DECLARE(10); VECTOR_DECLARE(11); VECTOR_DECLARE(12);
+VECTOR_DECLARE(13); VECTOR_DECLARE(14); VECTOR_DECLARE(15); VECTOR_DECLARE(16);
+VECTOR_DECLARE(17); VECTOR_DECLARE(18);
+
+extern uint8_t __start_sim_eeprom[] __attribute__((weak));
+extern uint8_t __stop_sim_eeprom[] __attribute__((weak));
+
+/* aligns the EEMEM section so the low bits of an EEMEM pointer are its
+ * EEPROM address, firmware may load EEAR straight from a pointer */
+static uint8_t sim_eeprom_base[0]
+		__attribute__((section("sim_eeprom"), aligned(SIM_EEPROM_SIZE), used));
+
+int avr_main(void);
+
+static void (*const vectors[19])(void) = {
+	0, __vector_1, __vector_2, __vector_3, __vector_4, __vector_5,
+	__vector_6, __vector_7, __vector_8, __vector_9, __vector_10,
+	__vector_11, __vector_12, __vector_13, __vector_14, __vector_15,
+	__vector_16, __vector_17, __vector_18
+};
+
+static const uint16_t prescale01[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+static const uint16_t prescale2[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+
+static const struct sim_host *host;
+
+/* core */
+static uint8_t io[0x40];
+static uint64_t cycles;
+static uint64_t deadline;
+static uint64_t updated;	// peripherals are up to date until here
+static uint8_t sleeping = AWAKE;
+static uint8_t halted;
+static ucontext_t host_ctx;
+static ucontext_t fw_ctx;
+static uint8_t fw_stack[SIM_STACK_SIZE];
+static uint64_t isr_cycles;
+static uint8_t isr_depth;	// handlers running, more than one if they nest
+static uint64_t idle_cycles;
+static uint64_t pwr_down_cycles;
+static uint64_t sleep_since;
+static uint64_t powered;	// time of the power-on reset
+
+/* lazy write detection */
+static uint8_t touch_addr[SIM_TOUCH_MAX];
+static uint8_t touch_val[SIM_TOUCH_MAX];
+static uint8_t touch_n;
+
+/* USART */
+static uint8_t ubrrh;
+static uint8_t ucsrc;
+static uint8_t uart_txc;
+static uint8_t uart_mode;	// U2X and MPCM
+static uint8_t tx_busy;
+static uint8_t tx_full;
+static uint8_t tx_udr;
+static uint64_t tx_end;
+static uint8_t rx_n;
+static uint8_t rx_data[2];
+static uint8_t rx_fe[2];
+static uint8_t rx_dor[2];
+static unsigned long rx_overruns;
+
+static struct {
+	uint8_t data;
+	uint8_t fe;
+	uint64_t when;
+} rxq[SIM_RXQ_SIZE];
+static uint8_t rxq_head;
+static uint8_t rxq_tail;
+
+/* EEPROM */
+static uint8_t eeprom[SIM_EEPROM_SIZE];
+static uint64_t ee_mwe_until;
+static uint64_t ee_busy_until;
+static uint8_t ee_busy;
+static uint16_t ee_waddr;
+static uint8_t ee_wdata;
+
+/* timers, prescaler phase in cycles */
+static uint32_t t0_phase;
+static uint32_t t1_phase;
+static uint32_t t2_phase;
+
+/* pins */
+static struct {
+	uint8_t a;
+	uint8_t b;
+	uint8_t pressed;
+} keys[SIM_KEY_MAX];
+static uint8_t nkeys;
+static uint8_t level[3];	// B, C, D
+static uint8_t ext_mask[3];		// inputs driven from outside
+static uint8_t ext_level[3];
+static struct {
+	uint8_t pin;
+	uint8_t level;
+	uint64_t when;
+} inq[SIM_INQ_SIZE];
+static uint8_t inq_head;
+static uint8_t inq_tail;
+static uint8_t oc1a;	// output compare latch of OC1A
+static uint8_t in_fw;	// running on the firmware context
+
+static void sim_update(void);
+static void sim_irq(void);
+
+/*
+ * clock and context switching
+ */
+
+static void sim_yield(void) {
+	swapcontext(&fw_ctx, &host_ctx);
+}
+
+static void sim_poll(void) {
+	sim_update();
+	sim_irq();
+	while (cycles >= deadline) {
+		sim_yield();
+		sim_update();
+		sim_irq();
+	}
+}
+
+/*
+ * USART
+ */
+
+static double uart_bit_cycles(void) {
+	uint16_t ubrr = ((uint16_t) (ubrrh & 0x0F) << 8) | IO(A_UBRRL);
+	return (uart_mode & _BV(U2X) ? 8.0 : 16.0) * (ubrr + 1);
+}
+
+static uint8_t uart_frame_bits(void) {
+	uint8_t bits = 1 + 5 + ((ucsrc >> UCSZ0) & 3) + 1;
+
+	if (ucsrc & _BV(UPM1)) {
+		++bits;
+	}
+	if (ucsrc & _BV(USBS)) {
+		++bits;
+	}
+	return bits;
+}
+
+static void uart_flags(void) {
+	uint8_t v = uart_mode;
+
+	if (rx_n) {
+		v |= _BV(RXC);
+		v |= rx_fe[0] ? _BV(FE) : 0;
+		v |= rx_dor[0] ? _BV(DOR) : 0;
+	}
+	v |= uart_txc ? _BV(TXC) : 0;
+	v |= tx_full ? 0 : _BV(UDRE);
+	IO(A_UCSRA) = v;
+}
+
+/* the harness hears of the byte as it starts, so it can put the frame on
+ * the other board's pins ahead of time */
+static void uart_start(uint8_t data, uint64_t when) {
+	tx_busy = 1;
+	tx_end = when + (uint64_t) (uart_frame_bits() * uart_bit_cycles());
+	if (host && host->uart_tx) {
+		host->uart_tx(host->ctx, data, when, uart_bit_cycles());
+	}
+}
+
+static void uart_write(uint8_t data) {
+	if (!(IO(A_UCSRB) & _BV(TXEN))) {
+		return;
+	}
+	if (!tx_busy) {
+		uart_start(data, cycles);
+	} else if (!tx_full) {
+		tx_udr = data;
+		tx_full = 1;
+	}
+	uart_flags();
+}
+
+static void uart_read(void) {
+	if (!rx_n) {
+		return;
+	}
+	rx_data[0] = rx_data[1];
+	rx_fe[0] = rx_fe[1];
+	rx_dor[0] = rx_dor[1];
+	--rx_n;
+	IO(A_UDR) = rx_data[0];
+	uart_flags();
+}
+
+static void uart_update(void) {
+	while (tx_busy && cycles >= tx_end) {
+		if (tx_full) {
+			tx_full = 0;
+			uart_start(tx_udr, tx_end);
+		} else {
+			tx_busy = 0;
+			uart_txc = 1;
+		}
+	}
+
+	while (rxq_head != rxq_tail && rxq[rxq_tail].when <= cycles) {
+		uint8_t i = rxq_tail;
+
+		rxq_tail = (rxq_tail + 1) % SIM_RXQ_SIZE;
+		if (!(IO(A_UCSRB) & _BV(RXEN)) || sleeping == MODE_PWR_DOWN
+				|| sleeping == MODE_PWR_SAVE || sleeping == MODE_STANDBY) {
+			continue;	// receiver is off or has no clock
+		}
+		if (rx_n == 2) {
+			rx_dor[1] = 1;	// third byte overruns the receive FIFO
+			++rx_overruns;
+			continue;
+		}
+		rx_data[rx_n] = rxq[i].data;
+		rx_fe[rx_n] = rxq[i].fe;
+		rx_dor[rx_n] = 0;
+		if (rx_n++ == 0) {
+			IO(A_UDR) = rx_data[0];
+		}
+	}
+	uart_flags();
+}
+
+/*
+ * EEPROM
+ */
+
+static void eeprom_control(uint8_t old, uint8_t val) {
+	uint16_t addr = (((uint16_t) IO(A_EEARH) << 8) | IO(A_EEARL)) & E2END;
+
+	if ((val & _BV(EEMWE)) && !(old & _BV(EEMWE))) {
+		ee_mwe_until = cycles + 4 + SIM_IO_CYCLES;
+	}
+	if ((val & _BV(EEWE)) && !(old & _BV(EEWE))) {
+		if (!ee_busy && (old & _BV(EEMWE)) && cycles <= ee_mwe_until) {
+			ee_busy = 1;
+			ee_waddr = addr;
+			ee_wdata = IO(A_EEDR);
+			ee_busy_until = cycles + (uint64_t) (F_CPU * 0.0085);
+		} else {
+			val &= ~_BV(EEWE);
+		}
+	}
+	if (val & _BV(EERE)) {
+		if (!ee_busy) {
+			IO(A_EEDR) = eeprom[addr];
+			cycles += 4;
+		}
+		val &= ~_BV(EERE);
+	}
+	IO(A_EECR) = val;
+}
+
+static void eeprom_update(void) {
+	if ((IO(A_EECR) & _BV(EEMWE)) && cycles > ee_mwe_until) {
+		IO(A_EECR) &= ~_BV(EEMWE);
+	}
+	if (ee_busy && cycles >= ee_busy_until) {
+		eeprom[ee_waddr] = ee_wdata;
+		ee_busy = 0;
+		IO(A_EECR) &= ~_BV(EEWE);
+	}
+}
+
+/*
+ * timers
+ */
+
+/* true if a counter moving n ticks forward from cnt, wrapping after top,
+ * passes through value v */
+static int timer_hits(uint32_t cnt, uint32_t top, uint32_t n, uint32_t v) {
+	if (v > top) {
+		return 0;
+	}
+	if (n > top) {
+		return 1;
+	}
+	return ((v + top + 1 - cnt - 1) % (top + 1)) < n;
+}
+
+/* ticks until a counter at cnt reaches v, wrapping after top */
+static uint32_t timer_until(uint32_t cnt, uint32_t top, uint32_t v) {
+	if (v > top) {
+		return UINT32_MAX;
+	}
+	return ((v + top + 1 - cnt - 1) % (top + 1)) + 1;
+}
+
+static uint8_t timer1_mode(void) {
+	return ((IO(A_TCCR1B) >> WGM12) & 3) << 2 | (IO(A_TCCR1A) & 3);
+}
+
+static uint32_t timer1_top(void) {
+	switch (timer1_mode()) {
+	case 1:
+	case 5:
+		return 0xFF;
+	case 2:
+	case 6:
+		return 0x1FF;
+	case 3:
+	case 7:
+		return 0x3FF;
+	case 4:
+	case 9:
+	case 11:
+	case 15:
+		return IO(A_OCR1A) | (IO(A_OCR1A + 1) << 8);
+	case 8:
+	case 10:
+	case 12:
+	case 14:
+		return IO(A_ICR1) | (IO(A_ICR1 + 1) << 8);
+	}
+	return 0xFFFF;
+}
+
+static uint32_t timer2_top(void) {
+	if ((IO(A_TCCR2) & (_BV(WGM21) | _BV(WGM20))) == _BV(WGM21)) {
+		return IO(A_OCR2);
+	}
+	return 0xFF;
+}
+
+static uint32_t timer_ticks(uint32_t *phase, uint16_t prescale, uint64_t dt) {
+	uint64_t total;
+
+	if (!prescale) {
+		return 0;
+	}
+	total = *phase + dt;
+	*phase = total % prescale;
+	return total / prescale;
+}
+
+/* compare output action of OC1A on a match, non-PWM modes only */
+static void oc1a_match(void) {
+	uint8_t mode = timer1_mode();
+
+	if (mode != 0 && mode != 4 && mode != 12) {
+		return;
+	}
+	switch ((IO(A_TCCR1A) >> COM1A0) & 3) {
+	case 1:
+		oc1a ^= 1;
+		break;
+	case 2:
+		oc1a = 0;
+		break;
+	case 3:
+		oc1a = 1;
+		break;
+	}
+}
+
+static void timers_step(uint64_t dt) {
+	uint32_t n;
+	uint32_t cnt;
+	uint32_t top;
+	uint32_t ocr;
+
+	/* timer 0, normal mode only */
+	n = timer_ticks(&t0_phase, prescale01[IO(A_TCCR0) & 7], dt);
+	if (n) {
+		cnt = IO(A_TCNT0);
+		if (cnt + n > 0xFF) {
+			IO(A_TIFR) |= _BV(TOV0);
+		}
+		IO(A_TCNT0) = (cnt + n) & 0xFF;
+	}
+
+	/* timer 1 */
+	n = timer_ticks(&t1_phase, prescale01[IO(A_TCCR1B) & 7], dt);
+	if (n) {
+		cnt = IO(A_TCNT1) | (IO(A_TCNT1 + 1) << 8);
+		top = timer1_top();
+		if (cnt > top) {
+			top = 0xFFFF;
+		}
+		ocr = IO(A_OCR1A) | (IO(A_OCR1A + 1) << 8);
+		if (timer_hits(cnt, top, n, ocr)) {
+			IO(A_TIFR) |= _BV(OCF1A);
+			oc1a_match();
+		}
+		ocr = IO(A_OCR1B) | (IO(A_OCR1B + 1) << 8);
+		if (timer_hits(cnt, top, n, ocr)) {
+			IO(A_TIFR) |= _BV(OCF1B);
+		}
+		if (cnt + n > top && (top == 0xFFFF || (timer1_mode() != 4
+				&& timer1_mode() != 12))) {
+			IO(A_TIFR) |= _BV(TOV1);
+		}
+		cnt = (cnt + n) % (top + 1);
+		IO(A_TCNT1) = cnt & 0xFF;
+		IO(A_TCNT1 + 1) = cnt >> 8;
+	}
+
+	/* timer 2 */
+	n = timer_ticks(&t2_phase, prescale2[IO(A_TCCR2) & 7], dt);
+	if (n) {
+		cnt = IO(A_TCNT2);
+		top = timer2_top();
+		if (cnt > top) {
+			top = 0xFF;
+		}
+		if (timer_hits(cnt, top, n, IO(A_OCR2))) {
+			IO(A_TIFR) |= _BV(OCF2);
+		}
+		if (cnt + n > top && top == 0xFF) {
+			IO(A_TIFR) |= _BV(TOV2);
+		}
+		IO(A_TCNT2) = (cnt + n) % (top + 1);
+	}
+}
+
+/* cycles until the next enabled timer interrupt flag gets set */
+static uint64_t timers_next(void) {
+	uint64_t next = UINT64_MAX;
+	uint64_t c;
+	uint32_t cnt;
+	uint32_t top;
+	uint32_t n;
+	uint16_t p;
+	uint8_t mask = IO(A_TIMSK);
+
+	p = prescale01[IO(A_TCCR0) & 7];
+	if (p && (mask & _BV(TOIE0))) {
+		c = (uint64_t) (0x100 - IO(A_TCNT0)) * p - t0_phase;
+		next = c < next ? c : next;
+	}
+
+	p = prescale01[IO(A_TCCR1B) & 7];
+	if (p && (mask & (_BV(OCIE1A) | _BV(OCIE1B) | _BV(TOIE1)))) {
+		cnt = IO(A_TCNT1) | (IO(A_TCNT1 + 1) << 8);
+		top = timer1_top();
+		if (cnt > top) {
+			top = 0xFFFF;
+		}
+		n = UINT32_MAX;
+		if (mask & _BV(OCIE1A)) {
+			uint32_t t = timer_until(cnt, top, IO(A_OCR1A) | (IO(A_OCR1A + 1) << 8));
+			n = t < n ? t : n;
+		}
+		if (mask & _BV(OCIE1B)) {
+			uint32_t t = timer_until(cnt, top, IO(A_OCR1B) | (IO(A_OCR1B + 1) << 8));
+			n = t < n ? t : n;
+		}
+		if (mask & _BV(TOIE1)) {
+			uint32_t t = top - cnt + 1;
+			n = t < n ? t : n;
+		}
+		if (n != UINT32_MAX) {
+			c = (uint64_t) n * p - t1_phase;
+			next = c < next ? c : next;
+		}
+	}
+
+	p = prescale2[IO(A_TCCR2) & 7];
+	if (p && (mask & (_BV(OCIE2) | _BV(TOIE2)))) {
+		cnt = IO(A_TCNT2);
+		top = timer2_top();
+		if (cnt > top) {
+			top = 0xFF;
+		}
+		n = UINT32_MAX;
+		if (mask & _BV(OCIE2)) {
+			uint32_t t = timer_until(cnt, top, IO(A_OCR2));
+			n = t < n ? t : n;
+		}
+		if (mask & _BV(TOIE2)) {
+			uint32_t t = top - cnt + 1;
+			n = t < n ? t : n;
+		}
+		if (n != UINT32_MAX) {
+			c = (uint64_t) n * p - t2_phase;
+			next = c < next ? c : next;
+		}
+	}
+
+	return next;
+}
+
+/*
+ * pins
+ */
+
+static uint8_t pin_level(uint8_t pin) {
+	return (level[pin >> 3] >> (pin & 7)) & 1;
+}
+
+static uint8_t pin_output(uint8_t pin) {
+	uint8_t ddr = IO(A_PIND + 1 + 3 * (2 - (pin >> 3)));
+	return (ddr >> (pin & 7)) & 1;
+}
+
+/* an input with its pullup on or driven from outside, as opposed to one
+ * that floats */
+static uint8_t pin_held(uint8_t pin) {
+	uint8_t p = pin >> 3;
+	uint8_t port = IO(A_PIND + 2 + 3 * (2 - p));
+	uint8_t pullup = (IO(A_SFIOR) & _BV(PUD)) ? 0 : port;
+
+	return ((pullup | ext_mask[p]) >> (pin & 7)) & 1;
+}
+
+/* input capture on ICP1 (PB0), latches TCNT1 as it was at the edge */
+static void icp_edge(uint8_t lvl, uint64_t when) {
+	uint8_t pin = SIM_PIN('B', 0);
+	uint8_t was = (ext_mask[0] & _BV(0)) ? (ext_level[0] & _BV(0)) : pin_level(pin);
+	uint16_t p = prescale01[IO(A_TCCR1B) & 7];
+	uint32_t cnt;
+	uint32_t top;
+
+	if (!was == !lvl || pin_output(pin) || !lvl != !(IO(A_TCCR1B) & _BV(ICES1))
+			|| sleeping == MODE_PWR_DOWN || sleeping == MODE_STANDBY
+			|| sleeping == MODE_PWR_SAVE) {
+		return;
+	}
+	cnt = IO(A_TCNT1) | (IO(A_TCNT1 + 1) << 8);
+	if (p) {
+		top = timer1_top();
+		if (cnt > top) {
+			top = 0xFFFF;
+		}
+		cnt = (cnt + (top + 1) - ((cycles - when) / p) % (top + 1)) % (top + 1);
+	}
+	IO(A_ICR1) = cnt & 0xFF;
+	IO(A_ICR1 + 1) = cnt >> 8;
+	IO(A_TIFR) |= _BV(ICF1);
+}
+
+static void pins_update(void) {
+	uint8_t old[3];
+	uint8_t i;
+	uint8_t p;
+
+	memcpy(old, level, sizeof(old));
+
+	for (p = 0; p < 3; ++p) {
+		uint8_t base = A_PIND + 3 * (2 - p);	// PINx, DDRx, PORTx
+		uint8_t ddr = IO(base + 1);
+		uint8_t port = IO(base + 2);
+		uint8_t pullup = (IO(A_SFIOR) & _BV(PUD)) ? 0 : port;
+
+		level[p] = (port & ddr) | (pullup & ~ddr);
+		level[p] = (level[p] & ~(ext_mask[p] & ~ddr))
+				| (ext_level[p] & ext_mask[p] & ~ddr);
+	}
+
+	/* OC1A overrides PB1 while its compare output is connected */
+	if ((IO(A_TCCR1A) & (_BV(COM1A1) | _BV(COM1A0)))
+			&& pin_output(SIM_PIN('B', 1))) {
+		level[0] = (level[0] & ~_BV(1)) | (oc1a << 1);
+	}
+
+	/* a closed switch pulls an input to the level of the other side */
+	for (i = 0; i < nkeys; ++i) {
+		uint8_t a = keys[i].a;
+		uint8_t b = keys[i].b;
+		uint8_t la;
+		uint8_t lb;
+
+		if (!keys[i].pressed) {
+			continue;
+		}
+		la = pin_level(a);
+		lb = pin_level(b);
+		if (pin_output(a) && !pin_output(b)) {
+			lb = la;
+		} else if (pin_output(b) && !pin_output(a)) {
+			la = lb;
+		} else if (pin_held(a) && !pin_held(b)) {
+			lb = la;	// both inputs, the floating one follows
+		} else if (pin_held(b) && !pin_held(a)) {
+			la = lb;
+		} else if (!pin_output(a) && !pin_output(b)) {
+			la = lb = la & lb;
+		}
+		level[a >> 3] = (level[a >> 3] & ~_BV(a & 7)) | (la << (a & 7));
+		level[b >> 3] = (level[b >> 3] & ~_BV(b & 7)) | (lb << (b & 7));
+	}
+
+	for (p = 0; p < 3; ++p) {
+		IO(A_PIND + 3 * (2 - p)) = level[p];
+	}
+
+	/* edge triggered external interrupts on PD2 and PD3, these need the
+	 * I/O clock and stay quiet in the deeper sleep modes */
+	for (i = 0; i < 2 && (sleeping == AWAKE || sleeping == MODE_IDLE
+			|| sleeping == MODE_ADC); ++i) {
+		uint8_t bit = 2 + i;
+		uint8_t sense = (IO(A_MCUCR) >> (2 * i)) & 3;
+		uint8_t was = (old[2] >> bit) & 1;
+		uint8_t now = (level[2] >> bit) & 1;
+
+		if (was != now && (sense == 1 || (sense == 2 && !now)
+				|| (sense == 3 && now))) {
+			IO(A_GIFR) |= i ? _BV(INTF1) : _BV(INTF0);
+		}
+	}
+
+	if (host && host->pin_change) {
+		for (p = 0; p < 3; ++p) {
+			uint8_t diff = old[p] ^ level[p];
+
+			for (i = 0; i < 8; ++i) {
+				if (diff & _BV(i)) {
+					host->pin_change(host->ctx, (p << 3) | i,
+							(level[p] >> i) & 1, cycles);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * register side effects
+ */
+
+static void sim_write(uint8_t addr, uint8_t old, uint8_t val) {
+	switch (addr) {
+	case A_UDR:
+		IO(A_UDR) = rx_n ? rx_data[0] : old;
+		uart_write(val);
+		break;
+	case A_UCSRA:
+		if (val & _BV(TXC)) {
+			uart_txc = 0;
+		}
+		uart_mode = val & (_BV(U2X) | _BV(MPCM));
+		uart_flags();
+		break;
+	case A_UBRRH:
+		if (val & _BV(URSEL)) {
+			ucsrc = val;
+		} else {
+			ubrrh = val;
+		}
+		break;
+	case A_EECR:
+		eeprom_control(old, val);
+		break;
+	case A_TIFR:
+	case A_GIFR:
+		IO(addr) = old & ~val;
+		break;
+	}
+}
+
+static void sim_commit(void) {
+	uint8_t i;
+	uint8_t n = touch_n;
+
+	touch_n = 0;
+	for (i = 0; i < n; ++i) {
+		uint8_t addr = touch_addr[i];
+
+		if (IO(addr) != touch_val[i]) {
+			sim_write(addr, touch_val[i], IO(addr));
+		} else if (addr == A_UDR) {
+			/* unchanged UDR, either a read or a repeated byte */
+			if (rx_n) {
+				uart_read();
+			} else {
+				uart_write(IO(addr));
+			}
+		}
+	}
+}
+
+static void sim_touch(uint8_t addr) {
+	if (touch_n < SIM_TOUCH_MAX) {
+		touch_addr[touch_n] = addr;
+		touch_val[touch_n] = IO(addr);
+		++touch_n;
+	}
+}
+
+/*
+ * interrupts
+ */
+
+static uint8_t irq_pending(uint8_t n) {
+	uint8_t mask = IO(A_TIMSK);
+	uint8_t flags = IO(A_TIFR);
+
+	switch (n) {
+	case 1:
+	case 2:
+		if (!(IO(A_GICR) & (n == 1 ? _BV(INT0) : _BV(INT1)))) {
+			return 0;
+		}
+		if (((IO(A_MCUCR) >> (2 * (n - 1))) & 3) == 0) {
+			return !((level[2] >> (n + 1)) & 1);	// low level
+		}
+		return IO(A_GIFR) & (n == 1 ? _BV(INTF0) : _BV(INTF1));
+	case 3:
+		return (mask & _BV(OCIE2)) && (flags & _BV(OCF2));
+	case 4:
+		return (mask & _BV(TOIE2)) && (flags & _BV(TOV2));
+	case 5:
+		return (mask & _BV(TICIE1)) && (flags & _BV(ICF1));
+	case 6:
+		return (mask & _BV(OCIE1A)) && (flags & _BV(OCF1A));
+	case 7:
+		return (mask & _BV(OCIE1B)) && (flags & _BV(OCF1B));
+	case 8:
+		return (mask & _BV(TOIE1)) && (flags & _BV(TOV1));
+	case 9:
+		return (mask & _BV(TOIE0)) && (flags & _BV(TOV0));
+	case 11:
+		return (IO(A_UCSRB) & _BV(RXCIE)) && rx_n;
+	case 12:
+		return (IO(A_UCSRB) & _BV(UDRIE)) && !tx_full;
+	case 13:
+		return (IO(A_UCSRB) & _BV(TXCIE)) && uart_txc;
+	case 15:
+		return (IO(A_EECR) & _BV(EERIE)) && !ee_busy;
+	}
+	return 0;
+}
+
+static void irq_ack(uint8_t n) {
+	static const uint8_t tifr_bit[10] = {
+		0, 0, 0, OCF2, TOV2, ICF1, OCF1A, OCF1B, TOV1, TOV0
+	};
+
+	if (n == 1 || n == 2) {
+		IO(A_GIFR) &= ~(n == 1 ? _BV(INTF0) : _BV(INTF1));
+	} else if (n >= 3 && n <= 9) {
+		IO(A_TIFR) &= ~_BV(tifr_bit[n]);
+	} else if (n == 13) {
+		uart_txc = 0;
+		uart_flags();
+	}
+}
+
+/* highest priority pending interrupt which may wake the given sleep mode */
+static uint8_t irq_next(uint8_t mode) {
+	uint8_t n;
+
+	for (n = 1; n < 19; ++n) {
+		if ((mode == MODE_PWR_DOWN || mode == MODE_PWR_SAVE
+				|| mode == MODE_STANDBY) && n > 2) {
+			break;
+		}
+		if (irq_pending(n)) {
+			return n;
+		}
+	}
+	return 0;
+}
+
+static void sim_irq(void) {
+	uint8_t n;
+
+	while ((IO(A_SREG) & _BV(SREG_I)) && (n = irq_next(AWAKE))) {
+		uint64_t start = cycles;
+
+		if (!vectors[n]) {
+			fprintf(stderr, "sim: interrupt %u has no handler\n", n);
+			abort();
+		}
+		irq_ack(n);
+		IO(A_SREG) &= ~_BV(SREG_I);
+		cycles += SIM_ISR_CYCLES;
+		++isr_depth;
+		vectors[n]();
+		sim_commit();
+		IO(A_SREG) |= _BV(SREG_I);
+		if (--isr_depth == 0) {
+			isr_cycles += cycles - start;	// nested ones are part of it
+		}
+		sim_update();
+	}
+}
+
+/*
+ * peripheral update
+ */
+
+static void sim_update(void) {
+	uint64_t dt = cycles - updated;
+
+	updated = cycles;
+	if (sleeping != MODE_PWR_DOWN && sleeping != MODE_STANDBY
+			&& sleeping != MODE_PWR_SAVE) {
+		timers_step(dt);
+	}
+	uart_update();
+	eeprom_update();
+	while (inq_head != inq_tail && inq[inq_tail].when <= cycles) {
+		uint8_t pin = inq[inq_tail].pin;
+
+		if (pin == SIM_PIN('B', 0)) {
+			icp_edge(inq[inq_tail].level, inq[inq_tail].when);
+		}
+		ext_mask[pin >> 3] |= _BV(pin & 7);
+		if (inq[inq_tail].level) {
+			ext_level[pin >> 3] |= _BV(pin & 7);
+		} else {
+			ext_level[pin >> 3] &= ~_BV(pin & 7);
+		}
+		inq_tail = (inq_tail + 1) % SIM_INQ_SIZE;
+	}
+	pins_update();
+}
+
+/* time of the next peripheral event while sleeping in the given mode */
+static uint64_t sim_next(uint8_t mode) {
+	uint64_t next = UINT64_MAX;
+	uint64_t t;
+
+	if (ee_busy) {
+		next = ee_busy_until;
+	}
+	if (inq_head != inq_tail && inq[inq_tail].when < next) {
+		next = inq[inq_tail].when;
+	}
+	if (mode == MODE_PWR_DOWN || mode == MODE_STANDBY || mode == MODE_PWR_SAVE) {
+		return next;
+	}
+	if (tx_busy && tx_end < next) {
+		next = tx_end;
+	}
+	if (rxq_head != rxq_tail && rxq[rxq_tail].when < next) {
+		next = rxq[rxq_tail].when;
+	}
+	t = timers_next();
+	if (t != UINT64_MAX && cycles + t < next) {
+		next = cycles + t;
+	}
+	return next;
+}
+
+/*
+ * entry points used by the stub headers
+ */
+
+volatile uint8_t *sim_io(uint8_t addr) {
+	/* firmware code called by the harness, e.g. through a probe, sees the
+	 * registers but neither takes time nor triggers anything */
+	if (!in_fw) {
+		return &io[addr];
+	}
+	sim_commit();
+	cycles += SIM_IO_CYCLES;
+	sim_poll();
+	sim_touch(addr);
+	return &io[addr];
+}
+
+volatile uint16_t *sim_io16(uint8_t addr) {
+	if (!in_fw) {
+		return (volatile uint16_t *) &io[addr];
+	}
+	sim_commit();
+	cycles += SIM_IO_CYCLES * 2;
+	sim_poll();
+	sim_touch(addr);
+	sim_touch(addr + 1);
+	return (volatile uint16_t *) &io[addr];
+}
+
+void sim_delay(uint32_t n) {
+	uint64_t target;
+
+	sim_commit();
+	target = cycles + n;
+	while (cycles < target) {
+		uint64_t before = isr_cycles;
+		uint64_t next = sim_next(AWAKE);
+
+		if (next > target) {
+			next = target;
+		}
+		if (next > deadline) {
+			next = deadline;
+		}
+		cycles = next > cycles ? next : cycles + 1;
+		sim_poll();
+		target += isr_cycles - before;	// ISRs stretch a delay loop
+	}
+}
+
+void sim_sleep(void) {
+	uint8_t mode;
+
+	sim_commit();
+	cycles += 1;
+	if (!(IO(A_MCUCR) & _BV(SE))) {
+		sim_poll();
+		return;
+	}
+
+	mode = (IO(A_MCUCR) >> SM0) & 7;
+	sleeping = mode;
+	sleep_since = cycles;
+	for (;;) {
+		uint64_t next;
+
+		sim_update();
+		if ((IO(A_SREG) & _BV(SREG_I)) && irq_next(mode)) {
+			break;
+		}
+		if (cycles >= deadline) {
+			sim_yield();
+			continue;
+		}
+		next = sim_next(mode);
+		cycles = next < deadline ? (next > cycles ? next : cycles + 1) : deadline;
+	}
+	if (mode == MODE_IDLE || mode == MODE_ADC) {
+		idle_cycles += cycles - sleep_since;
+	} else {
+		pwr_down_cycles += cycles - sleep_since;
+	}
+	sleeping = AWAKE;
+	cycles += SIM_WAKE_CYCLES;
+	sim_poll();
+}
+
+/*
+ * EEPROM access routines from avr/eeprom.h
+ */
+
+static uint16_t ee_addr(const void *p) {
+	if ((uintptr_t) p <= E2END) {
+		return (uintptr_t) p;	// plain EEPROM address
+	}
+	return ((const uint8_t *) p - __start_sim_eeprom) & E2END;
+}
+
+uint8_t eeprom_read_byte(const uint8_t *p) {
+	eeprom_busy_wait();
+	EEAR = ee_addr(p);
+	EECR |= _BV(EERE);
+	return EEDR;
+}
+
+uint16_t eeprom_read_word(const uint16_t *p) {
+	return eeprom_read_byte((const uint8_t *) p)
+			| (eeprom_read_byte((const uint8_t *) p + 1) << 8);
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n) {
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+
+	while (n--) {
+		*d++ = eeprom_read_byte(s++);
+	}
+}
+
+void eeprom_write_byte(uint8_t *p, uint8_t value) {
+	eeprom_busy_wait();
+	EEAR = ee_addr(p);
+	EEDR = value;
+	EECR |= _BV(EEMWE);
+	EECR |= _BV(EEWE);
+}
+
+void eeprom_write_word(uint16_t *p, uint16_t value) {
+	eeprom_write_byte((uint8_t *) p, value);
+	eeprom_write_byte((uint8_t *) p + 1, value >> 8);
+}
+
+void eeprom_write_block(const void *src, void *dst, size_t n) {
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+
+	while (n--) {
+		eeprom_write_byte(d++, *s++);
+	}
+}
+
+void eeprom_update_byte(uint8_t *p, uint8_t value) {
+	if (eeprom_read_byte(p) != value) {
+		eeprom_write_byte(p, value);
+	}
+}
+
+void eeprom_update_word(uint16_t *p, uint16_t value) {
+	eeprom_update_byte((uint8_t *) p, value);
+	eeprom_update_byte((uint8_t *) p + 1, value >> 8);
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n) {
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+
+	while (n--) {
+		eeprom_update_byte(d++, *s++);
+	}
+}
+
+void sim_event(uint8_t type, uint8_t arg) {
+	if (host && host->event) {
+		host->event(host->ctx, type, arg, cycles);
+	}
+}
+
+/*
+ * harness interface
+ */
+
+static void fw_entry(void) {
+	avr_main();
+	halted = 1;
+	for (;;) {
+		sim_yield();
+	}
+}
+
+static void mcu_reset(const struct sim_host *h, uint64_t when) {
+	host = h;
+	memset(io, 0, sizeof(io));
+	IO(A_UCSRA) = _BV(UDRE);
+	ucsrc = _BV(URSEL) | _BV(UCSZ1) | _BV(UCSZ0);
+	ubrrh = 0;
+	uart_txc = uart_mode = 0;
+	tx_busy = tx_full = 0;
+	rx_n = 0;
+	rx_overruns = 0;
+	rxq_head = rxq_tail = 0;
+	ee_busy = 0;
+	t0_phase = t1_phase = t2_phase = 0;
+	oc1a = 0;
+	inq_head = inq_tail = 0;
+	memset(ext_mask, 0, sizeof(ext_mask));
+	touch_n = 0;
+	cycles = updated = deadline = powered = when;
+	isr_cycles = idle_cycles = pwr_down_cycles = 0;
+	sleeping = AWAKE;
+	halted = 0;
+	pins_update();
+
+	getcontext(&fw_ctx);
+	fw_ctx.uc_stack.ss_sp = fw_stack;
+	fw_ctx.uc_stack.ss_size = sizeof(fw_stack);
+	fw_ctx.uc_link = 0;
+	makecontext(&fw_ctx, fw_entry, 0);
+}
+
+static void mcu_run(uint64_t until) {
+	if (halted) {
+		cycles = until > cycles ? until : cycles;
+		return;
+	}
+	deadline = until;
+	in_fw = 1;
+	swapcontext(&host_ctx, &fw_ctx);
+	in_fw = 0;
+}
+
+static uint64_t mcu_clock(void) {
+	return cycles;
+}
+
+static void mcu_power(struct sim_power *p) {
+	p->idle = idle_cycles;
+	p->pwr_down = pwr_down_cycles;
+
+	/* the firmware may be in the middle of a sleep */
+	if (sleeping == MODE_IDLE || sleeping == MODE_ADC) {
+		p->idle += cycles - sleep_since;
+	} else if (sleeping != AWAKE) {
+		p->pwr_down += cycles - sleep_since;
+	}
+	p->active = cycles - powered - p->idle - p->pwr_down;
+	p->isr = isr_cycles;
+}
+
+static void mcu_uart_rx(uint8_t data, uint8_t fe, uint64_t when) {
+	uint8_t next = (rxq_head + 1) % SIM_RXQ_SIZE;
+
+	if (next == rxq_tail) {
+		return;
+	}
+	rxq[rxq_head].data = data;
+	rxq[rxq_head].fe = fe;
+	rxq[rxq_head].when = when;
+	rxq_head = next;
+}
+
+static double mcu_uart_bit(void) {
+	return uart_bit_cycles();
+}
+
+static unsigned long mcu_uart_overruns(void) {
+	return rx_overruns;
+}
+
+static void mcu_key(uint8_t a, uint8_t b, uint8_t pressed) {
+	uint8_t i;
+
+	for (i = 0; i < nkeys; ++i) {
+		if (keys[i].a == a && keys[i].b == b) {
+			keys[i].pressed = pressed;
+			return;
+		}
+	}
+	if (nkeys < SIM_KEY_MAX) {
+		keys[nkeys].a = a;
+		keys[nkeys].b = b;
+		keys[nkeys].pressed = pressed;
+		++nkeys;
+	}
+}
+
+/* kept in time order, changes to different pins may be queued out of it */
+static void mcu_input(uint8_t pin, uint8_t level, uint64_t when) {
+	uint8_t next = (inq_head + 1) % SIM_INQ_SIZE;
+	uint8_t i = inq_head;
+
+	if (next == inq_tail) {
+		return;
+	}
+	while (i != inq_tail) {
+		uint8_t prev = (i + SIM_INQ_SIZE - 1) % SIM_INQ_SIZE;
+
+		if (inq[prev].when <= when) {
+			break;
+		}
+		inq[i] = inq[prev];
+		i = prev;
+	}
+	inq[i].pin = pin;
+	inq[i].level = level;
+	inq[i].when = when;
+	inq_head = next;
+}
+
+static uint8_t mcu_pin(uint8_t pin) {
+	return pin_level(pin);
+}
+
+static uint8_t mcu_pwm(uint8_t pin) {
+	uint8_t tccr2 = IO(A_TCCR2);
+
+	/* OC2 in fast or phase correct PWM mode, non-inverting */
+	if (pin == SIM_PIN('B', 3) && (tccr2 & _BV(WGM20)) && (tccr2 & 7)
+			&& (tccr2 & (_BV(COM21) | _BV(COM20))) == _BV(COM21)) {
+		return IO(A_OCR2);
+	}
+	return pin_level(pin) ? 255 : 0;
+}
+
+static void mcu_program(void) {
+	size_t n = __stop_sim_eeprom - __start_sim_eeprom;
+
+	memset(eeprom, 0xFF, sizeof(eeprom));
+	if (__start_sim_eeprom && n <= sizeof(eeprom)) {
+		memcpy(eeprom, __start_sim_eeprom, n);
+	}
+}
+
+__attribute__((visibility("default")))
+const struct sim_mcu sim_mcu = {
+	mcu_reset,
+	mcu_run,
+	mcu_clock,
+	mcu_power,
+	mcu_uart_rx,
+	mcu_uart_bit,
+	mcu_uart_overruns,
+	mcu_key,
+	mcu_input,
+	mcu_pin,
+	mcu_pwm,
+	mcu_program,
+	eeprom
+};
@@ -0,0 +1,117 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * mcu.h
+ *
+ * Interface between the simulation harness and one simulated ATmega8.
+ * Each firmware image is linked together with mcu.c into its own shared
+ * object, which exports a single struct sim_mcu named "sim_mcu".
+ */
+
+#ifndef SIM_MCU_H_
+#define SIM_MCU_H_
+
+#include <stdint.h>
+
+/* pin identifiers, e.g. SIM_PIN('D', 3) for PD3 */
+#define SIM_PIN(port, bit)	((uint8_t) ((((port) - 'B') << 3) | (bit)))
+
+#define SIM_EEPROM_SIZE		512
+
+/* events reported by the firmware probes */
+#define SIM_EV_SEND		1	// transmitter queued a command, arg = command
+#define SIM_EV_CMD		2	// receiver handed a command to main(), arg = command
+#define SIM_EV_DATA		3	// follows SIM_EV_SEND and SIM_EV_CMD once per payload byte
+#define SIM_EV_RESTORE	4	// receiver restored its state, arg = power, speed follows
+#define SIM_EV_MAC		5	// a MAC was computed, arg = cipher blocks
+#define SIM_EV_FETCH	6	// receiver main() takes a packet off the queue
+#define SIM_EV_REJECT	7	// follows SIM_EV_FETCH if rx_getcmd() dropped the packet
+#define SIM_EV_FROM		8	// precedes SIM_EV_CMD, arg = low byte of the remote ID
+#define SIM_EV_SEQ		9	// precedes SIM_EV_CMD, arg = sequence number
+
+/* the receiver probe exports sim_rx_stats(uint16_t *c), which fills in the
+ * counters of struct rx_stats in src/rx/rfrx.h in this order */
+#define SIM_RX_FRAMES	0
+#define SIM_RX_CRC		1
+#define SIM_RX_REPEATS	2
+#define SIM_RX_DROPS	3
+#define SIM_RX_MAC		4
+#define SIM_RX_FE		5
+#define SIM_RX_DOR		6
+#define SIM_RX_RESYNC	7
+#define SIM_RX_VOTED	8
+#define SIM_RX_STATS	9
+
+/* plain computation costs no simulated time, the probes charge these for
+ * the cipher. Both are guesses, about 60 cycles a round for 32-bit adds,
+ * rotates and key loads, and have not been measured on an AVR build of
+ * src/rx/auth.c. Latency figures with AUTH_SPECK depend on them. */
+#define SIM_SPECK_CYCLES	1600	// one Speck64/128 block, 27 rounds, unmeasured
+#define SIM_MAC_CYCLES		200		// padding and copying around the blocks, unmeasured
+
+/* where the clock went since reset, in cycles */
+struct sim_power {
+	uint64_t active;		// CPU running, including interrupt handlers
+	uint64_t isr;			// part of active spent in interrupt handlers
+	uint64_t idle;			// SLEEP_MODE_IDLE and SLEEP_MODE_ADC
+	uint64_t pwr_down;		// SLEEP_MODE_PWR_DOWN, PWR_SAVE and STANDBY
+};
+
+/* callbacks into the harness, invoked with the simulated time in cycles */
+struct sim_host {
+	void *ctx;
+	/* a byte starts going out on TXD, bit = length of one bit in cycles */
+	void (*uart_tx)(void *ctx, uint8_t data, uint64_t start, double bit);
+	/* an output pin changed level */
+	void (*pin_change)(void *ctx, uint8_t pin, uint8_t level, uint64_t when);
+	/* a firmware probe fired */
+	void (*event)(void *ctx, uint8_t type, uint8_t arg, uint64_t when);
+};
+
+struct sim_mcu {
+	/* power-on reset at the given time, the EEPROM keeps its contents */
+	void (*reset)(const struct sim_host *host, uint64_t when);
+	/* run the firmware until the clock reaches the given cycle count */
+	void (*run)(uint64_t until);
+	uint64_t (*clock)(void);
+	void (*power)(struct sim_power *p);
+
+	/* a byte arrives on RXD, it becomes readable at the given time */
+	void (*uart_rx)(uint8_t data, uint8_t fe, uint64_t when);
+	/* current length of one UART bit in cycles */
+	double (*uart_bit)(void);
+	/* bytes lost because the receive FIFO was full, since reset */
+	unsigned long (*uart_overruns)(void);
+
+	/* a switch wired between two pins */
+	void (*key)(uint8_t a, uint8_t b, uint8_t pressed);
+	/* drive an input pin from outside, the level changes at the given time */
+	void (*input)(uint8_t pin, uint8_t level, uint64_t when);
+	/* level of a pin as seen from outside */
+	uint8_t (*pin)(uint8_t pin);
+	/* duty cycle of a pin driven by a timer in PWM mode, 0-255, otherwise
+	 * 0 or 255 following its level */
+	uint8_t (*pwm)(uint8_t pin);
+
+	/* load the EEMEM initialisers into the EEPROM, like flashing main.eep */
+	void (*program)(void);
+	uint8_t *eeprom;
+};
+
+/* called by the firmware probes, reports an event to the harness */
+void sim_event(uint8_t type, uint8_t arg);
+
+#endif /* SIM_MCU_H_ */
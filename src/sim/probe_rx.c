@@ -0,0 +1,96 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * probe_rx.c
+ *
+ * Linked into the receiver image with -Wl,--wrap, reports every command
+ * handed to main(), the packets it dropped, the state restored at boot and
+ * the MACs computed without touching the firmware sources. Also lets the
+ * harness read the receive counters.
+ */
+
+#include <avr/io.h>
+
+#include "rfrx.h"
+#include "eelog.h"
+#include "auth.h"
+#include "mcu.h"
+
+uint8_t __real_rx_getcmd(struct rx_packet *pkt);
+
+uint8_t __wrap_rx_getcmd(struct rx_packet *pkt) {
+	uint8_t queued = rx_pending();
+	uint8_t cmd;
+	uint8_t i;
+
+	if (queued) {
+		sim_event(SIM_EV_FETCH, 0);
+	}
+	cmd = __real_rx_getcmd(pkt);
+	if (cmd) {
+		sim_event(SIM_EV_FROM, pkt->id & 0xFF);
+		sim_event(SIM_EV_SEQ, pkt->seq);
+		sim_event(SIM_EV_CMD, cmd);
+		for (i = 0; i < pkt->len; ++i) {
+			sim_event(SIM_EV_DATA, pkt->data[i]);
+		}
+	} else if (queued) {
+		sim_event(SIM_EV_REJECT, 0);
+	}
+	return cmd;
+}
+
+__attribute__((visibility("default")))
+void sim_rx_stats(uint16_t *c) {
+	struct rx_stats s;
+
+	rx_stats(&s);
+	c[SIM_RX_FRAMES] = s.frames;
+	c[SIM_RX_CRC] = s.crc;
+	c[SIM_RX_REPEATS] = s.repeats;
+	c[SIM_RX_DROPS] = s.drops;
+	c[SIM_RX_MAC] = s.mac;
+	c[SIM_RX_FE] = s.fe;
+	c[SIM_RX_DOR] = s.dor;
+	c[SIM_RX_RESYNC] = s.resync;
+	c[SIM_RX_VOTED] = s.voted;
+}
+
+uint8_t __real_eelog_read(uint8_t *state, uint8_t *speed, uint8_t *extra);
+
+uint8_t __wrap_eelog_read(uint8_t *state, uint8_t *speed, uint8_t *extra) {
+	uint8_t found = __real_eelog_read(state, speed, extra);
+
+	if (found & EELOG_FOUND) {
+		sim_event(SIM_EV_RESTORE, *state);
+		sim_event(SIM_EV_DATA, *speed);
+	}
+	return found;
+}
+
+#if (AUTH != AUTH_NONE)
+void __real_auth_mac(uint8_t *mac, uint32_t ctr, const uint8_t *msg,
+		uint8_t len);
+
+void __wrap_auth_mac(uint8_t *mac, uint32_t ctr, const uint8_t *msg,
+		uint8_t len) {
+	uint8_t blocks = (len + 4 + 7) / 8;	// counter in front, zero padded
+
+	__real_auth_mac(mac, ctr, msg, len);
+	sim_delay(SIM_MAC_CYCLES + blocks * SIM_SPECK_CYCLES);
+	sim_event(SIM_EV_MAC, blocks);
+}
+#endif
@@ -0,0 +1,59 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * probe_tx.c
+ *
+ * Linked into the transmitter image with -Wl,--wrap, reports every
+ * command main() hands to the RF link and charges the time the MAC takes.
+ */
+
+#include <avr/io.h>
+
+#include "rftx.h"
+#include "auth.h"
+#include "mcu.h"
+
+void __real_tx_putcmd(uint8_t cmd);
+void __real_tx_putpacket(uint8_t cmd, const uint8_t *data, uint8_t len);
+
+void __wrap_tx_putcmd(uint8_t cmd) {
+	sim_event(SIM_EV_SEND, cmd);
+	__real_tx_putcmd(cmd);
+}
+
+void __wrap_tx_putpacket(uint8_t cmd, const uint8_t *data, uint8_t len) {
+	uint8_t i;
+
+	sim_event(SIM_EV_SEND, cmd);
+	for (i = 0; i < len; ++i) {
+		sim_event(SIM_EV_DATA, data[i]);
+	}
+	__real_tx_putpacket(cmd, data, len);
+}
+
+#if (AUTH != AUTH_NONE)
+void __real_auth_mac(uint8_t *mac, uint32_t ctr, const uint8_t *msg,
+		uint8_t len);
+
+void __wrap_auth_mac(uint8_t *mac, uint32_t ctr, const uint8_t *msg,
+		uint8_t len) {
+	uint8_t blocks = (len + 4 + 7) / 8;
+
+	__real_auth_mac(mac, ctr, msg, len);
+	sim_delay(SIM_MAC_CYCLES + blocks * SIM_SPECK_CYCLES);
+	sim_event(SIM_EV_MAC, blocks);
+}
+#endif
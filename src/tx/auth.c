@@ -0,0 +1,104 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * auth.c
+ */
+
+#include <stdint.h>
+
+#include "auth.h"
+
+#if (AUTH != AUTH_NONE)
+
+#define SPECK_ROUNDS	27
+
+static uint32_t speck_keys[SPECK_ROUNDS];	// expanded once by auth_init()
+
+static inline uint32_t ror32(uint32_t x, uint8_t r) {
+	return (x >> r) | (x << (32 - r));
+}
+
+static inline uint32_t rol32(uint32_t x, uint8_t r) {
+	return (x << r) | (x >> (32 - r));
+}
+
+static uint32_t load32(const uint8_t *p) {
+	return p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16)
+			| ((uint32_t) p[3] << 24);
+}
+
+static void store32(uint8_t *p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* Speck64/128 key schedule, 108 bytes of RAM save redoing it per block */
+void auth_init(const uint8_t *key) {
+	uint32_t k = load32(key);
+	uint32_t l[3];
+	uint8_t i;
+
+	l[0] = load32(key + 4);
+	l[1] = load32(key + 8);
+	l[2] = load32(key + 12);
+	for (i = 0; i < SPECK_ROUNDS; ++i) {
+		speck_keys[i] = k;
+		l[i % 3] = (k + ror32(l[i % 3], 8)) ^ i;
+		k = rol32(k, 3) ^ l[i % 3];
+	}
+}
+
+void speck_encrypt(uint8_t *block) {
+	uint32_t x = load32(block + 4);
+	uint32_t y = load32(block);
+	uint8_t i;
+
+	for (i = 0; i < SPECK_ROUNDS; ++i) {
+		x = (ror32(x, 8) + y) ^ speck_keys[i];
+		y = rol32(y, 3) ^ x;
+	}
+	store32(block + 4, x);
+	store32(block, y);
+}
+
+void auth_mac(uint8_t *mac, uint32_t ctr, const uint8_t *msg, uint8_t len) {
+	uint8_t block[8];
+	uint8_t n = 4;	// bytes of the current block filled
+	uint8_t i;
+
+	store32(block, ctr);
+	for (i = 4; i < 8; ++i) {
+		block[i] = 0;
+	}
+	while (len--) {
+		block[n++] ^= *msg++;
+		if (n == 8) {
+			speck_encrypt(block);
+			n = 0;
+		}
+	}
+	if (n) {
+		speck_encrypt(block);	// zero padded
+	}
+	for (i = 0; i < AUTH_MAC_SIZE; ++i) {
+		mac[i] = block[i];
+	}
+}
+
+#endif
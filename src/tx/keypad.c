@@ -0,0 +1,212 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * keypad.c
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+#include "keypad.h"
+#include "utils.h"
+
+#define KEY_ROW_PORT	PORTD
+#define KEY_ROW1_PIN	PD3		// INT1
+#define KEY_ROW2_PIN	PD2		// INT0
+#define KEY_COL_PORT	PORTB
+#define KEY_COL1_PIN	PB5
+#define KEY_COL2_PIN	PB4
+#define KEY_COL3_PIN	PB3
+#define KEY_COL_MASK	(bv(KEY_COL1_PIN) | bv(KEY_COL2_PIN) | bv(KEY_COL3_PIN))
+#define KEY_ROW_MASK	(bv(KEY_ROW1_PIN) | bv(KEY_ROW2_PIN))
+#define KEY_COLS		3
+#define KEY_MAX			(2 * KEY_COLS)
+
+#define KEY_BUFFER_MASK	(KEY_BUFFER_SIZE - 1)
+
+#if (KEY_BUFFER_SIZE & KEY_BUFFER_MASK)
+#error KEY buffer size is not a power of 2
+#endif
+
+/* scan period, counted by timer 2 at clk/64 in CTC mode */
+#define KEY_TICKS		((KEY_SCAN_MS * (F_CPU / 1000UL) + 63) / 64)
+#define MS_TO_SCANS(ms)	(((ms) + KEY_SCAN_MS - 1) / KEY_SCAN_MS)
+
+#if (KEY_TICKS < 2 || KEY_TICKS > 256)
+#error "KEY_SCAN_MS out of range for timer 2"
+#endif
+
+#if (MS_TO_SCANS(KEY_HOLD_MS) > 0xFFFF || MS_TO_SCANS(KEY_DELAY_MS) == 0 || MS_TO_SCANS(KEY_REPEAT_MS) == 0)
+#error "KEY_DELAY_MS, KEY_REPEAT_MS or KEY_HOLD_MS out of range"
+#endif
+
+#if (KEY_DEBOUNCE == 0 || KEY_DEBOUNCE > 255)
+#error "KEY_DEBOUNCE out of range"
+#endif
+
+static const uint8_t key_col[KEY_COLS] = { KEY_COL1_PIN, KEY_COL2_PIN, KEY_COL3_PIN };
+
+static uint8_t key_count[KEY_MAX + 1];	// integrators, KEY_DEBOUNCE is down
+static volatile uint8_t key_mask;	// debounced keys, one bit per key code
+static uint8_t key_last;		// key pressed last while it is still down
+static uint8_t key_repeated;	// key_last has repeated or reported a hold
+static uint16_t key_scans;		// scans since the press or the last repeat
+static volatile uint8_t key_buf[KEY_BUFFER_SIZE];
+static volatile uint8_t key_head = 0;
+static volatile uint8_t key_tail = 0;
+static volatile uint8_t key_running = 0;
+
+/* an event that does not fit is lost, main() drains the queue every scan */
+static void key_put(uint8_t ev) {
+	uint8_t tmphead = (key_head + 1) & KEY_BUFFER_MASK;
+
+	if (tmphead != key_tail) {
+		key_buf[tmphead] = ev;
+		key_head = tmphead;
+	}
+}
+
+/* every column low, a key pulls its row low and wakes the CPU */
+static void key_wait(void) {
+	TCCR2 = 0;
+	key_running = 0;
+	ddr(KEY_COL_PORT) |= KEY_COL_MASK;
+	GIFR = (1 << INTF0) | (1 << INTF1);
+	GIMSK |= (1 << INT0) | (1 << INT1);
+}
+
+/* drive one column low at a time, the others float */
+static uint8_t key_read(void) {
+	uint8_t raw = 0;
+	uint8_t rows;
+	uint8_t c;
+
+	for (c = 0; c < KEY_COLS; ++c) {
+		ddr(KEY_COL_PORT) = (ddr(KEY_COL_PORT) & ~KEY_COL_MASK) | bv(key_col[c]);
+		_delay_us(4);	// let the pullups lift rows the last column held low
+		rows = pin(KEY_ROW_PORT);
+		if (bit_is_clr(rows, KEY_ROW1_PIN)) {
+			raw |= bv(1 + c);
+		}
+		if (bit_is_clr(rows, KEY_ROW2_PIN)) {
+			raw |= bv(1 + KEY_COLS + c);
+		}
+	}
+	ddr(KEY_COL_PORT) |= KEY_COL_MASK;
+
+	return raw;
+}
+
+/* a key pulled a row low, mask the level interrupts and start scanning */
+static void key_wake(void) {
+	GIMSK &= ~((1 << INT0) | (1 << INT1));
+	if (!key_running) {
+		key_running = 1;
+		TCNT2 = KEY_TICKS - 2;	// first scan one timer tick later
+		TCCR2 = (1 << WGM21) | (1 << CS22);	// CTC, clk/64
+	}
+}
+
+ISR(INT0_vect) {
+	key_wake();
+}
+
+ISR(INT1_vect) {
+	key_wake();
+}
+
+ISR(TIMER2_COMP_vect) {
+	uint8_t raw = key_read();
+	uint8_t busy = 0;
+	uint8_t k;
+
+	for (k = 1; k <= KEY_MAX; ++k) {
+		if (raw & bv(k)) {
+			if (key_count[k] < KEY_DEBOUNCE && ++key_count[k] == KEY_DEBOUNCE
+					&& !(key_mask & bv(k))) {
+				key_mask |= bv(k);
+				key_last = k;
+				key_repeated = 0;
+				key_scans = 0;
+				key_put(KEY_PRESS | k);
+			}
+		} else if (key_count[k] && --key_count[k] == 0 && (key_mask & bv(k))) {
+			key_mask &= ~bv(k);
+			if (key_last == k) {
+				key_last = 0;
+			}
+			key_put(KEY_RELEASE | k);
+		}
+		busy |= key_count[k];
+	}
+
+	if (key_last) {
+		++key_scans;
+		if (bv(key_last) & (KEY_REPEAT_KEYS)) {
+			if (key_scans >= (key_repeated ? MS_TO_SCANS(KEY_REPEAT_MS)
+					: MS_TO_SCANS(KEY_DELAY_MS))) {
+				key_repeated = 1;
+				key_scans = 0;
+				key_put(KEY_REPEAT | key_last);
+			}
+		} else if (!key_repeated && key_scans >= MS_TO_SCANS(KEY_HOLD_MS)) {
+			key_repeated = 1;
+			key_put(KEY_HOLD | key_last);
+		}
+	}
+
+	/* all keys up and settled */
+	if (!busy) {
+		key_wait();
+	}
+}
+
+void key_init(void) {
+	cbit(ddr(KEY_ROW_PORT), KEY_ROW1_PIN);	// input
+	cbit(ddr(KEY_ROW_PORT), KEY_ROW2_PIN);
+	KEY_ROW_PORT |= KEY_ROW_MASK;			// enable pullups
+	KEY_COL_PORT &= ~KEY_COL_MASK;			// columns only ever drive low
+
+	MCUCR &= ~((1 << ISC11) | (1 << ISC10) | (1 << ISC01) | (1 << ISC00));	// low level
+	OCR2 = KEY_TICKS - 1;
+	TIMSK |= (1 << OCIE2);
+	key_wait();
+}
+
+uint8_t key_event(void) {
+	uint8_t tmptail;
+
+	if (key_head == key_tail) {
+		return 0;
+	}
+	tmptail = (key_tail + 1) & KEY_BUFFER_MASK;
+	key_tail = tmptail;
+
+	return key_buf[tmptail];
+}
+
+uint8_t key_pending(void) {
+	return key_head != key_tail;
+}
+
+uint8_t key_down(void) {
+	return key_mask;
+}
+
+uint8_t key_active(void) {
+	return key_running;
+}
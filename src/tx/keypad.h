@@ -0,0 +1,84 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * keypad.h
+ */
+
+#ifndef KEYPAD_H_
+#define KEYPAD_H_
+
+#include <stdint.h>
+
+/* key codes, row by row, 0 is no key */
+#define KEY_PWR		1		// toggle power on/off, held to pair
+#define KEY_INC		2		// increase speed
+#define KEY_DEC		3		// decrease speed
+#define KEY_OFF		4		// power off
+#define KEY_LOW		5		// power on at the low preset
+#define KEY_HIGH	6		// power on at the high preset
+
+/* events are a type and a key code */
+#define KEY_PRESS	0x00
+#define KEY_REPEAT	0x40	// auto-repeat of a held key in KEY_REPEAT_KEYS
+#define KEY_HOLD	0x80	// any other key held for KEY_HOLD_MS, once per press
+#define KEY_RELEASE	0xC0
+#define key_type(ev)	((ev) & 0xC0)
+#define key_code(ev)	((ev) & 0x3F)
+
+#ifndef KEY_SCAN_MS
+#define KEY_SCAN_MS		2		// matrix scan period while a key is down
+#endif
+#ifndef KEY_DEBOUNCE
+#define KEY_DEBOUNCE	3		// scans a key has to agree on before it changes
+#endif
+#ifndef KEY_DELAY_MS
+#define KEY_DELAY_MS	250		// press to the first repeat
+#endif
+#ifndef KEY_REPEAT_MS
+#define KEY_REPEAT_MS	100		// between repeats
+#endif
+#ifndef KEY_HOLD_MS
+#define KEY_HOLD_MS		3000
+#endif
+#ifndef KEY_REPEAT_KEYS
+#define KEY_REPEAT_KEYS	((1 << KEY_INC) | (1 << KEY_DEC))
+#endif
+
+/* size of the event queue, must be power of 2 */
+#ifndef KEY_BUFFER_SIZE
+#define KEY_BUFFER_SIZE	8
+#endif
+
+/*
+ * Keys sit on a 2x3 matrix, the rows PD3 and PD2 are inputs with pullups
+ * on INT1 and INT0, the columns PB5, PB4 and PB3 are driven low. Any key
+ * wakes the CPU from power-down, timer 2 then scans the matrix every
+ * KEY_SCAN_MS until all keys have been released and stopped bouncing.
+ * Two keys can be down at once, more need a diode in series with each
+ * key to keep the matrix from ghosting.
+ *
+ * Each key has an integrator that counts scans up to KEY_DEBOUNCE while
+ * the key reads closed and down to 0 while it reads open, the key only
+ * changes at either end. Contact bounce never makes it to an event. Only
+ * the key pressed last repeats or reports a hold.
+ */
+void key_init(void);
+uint8_t key_event(void);	// next event, 0 if there is none
+uint8_t key_pending(void);	// an event is waiting for key_event()
+uint8_t key_down(void);		// bit mask of the keys that are down
+uint8_t key_active(void);	// the scan timer needs the I/O clock
+
+#endif /* KEYPAD_H_ */
@@ -0,0 +1,104 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * linecode.c
+ */
+
+#include <avr/pgmspace.h>
+
+#include "linecode.h"
+
+#if (LINE_CODE == LINE_CODE_4B8B)
+const uint8_t lc_enc_table[16] PROGMEM = {
+	0x2B, 0x2D, 0x33, 0x35, 0x36, 0x4B, 0x4D, 0x53,
+	0x56, 0x59, 0x5A, 0x65, 0x66, 0x69, 0x6A, 0x93
+};
+
+const uint8_t lc_dec_table[256] PROGMEM = {
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0x00, 0xFF, 0x01, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0x02, 0xFF, 0x03, 0x04, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0x05, 0xFF, 0x06, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0x07, 0xFF, 0xFF, 0x08, 0xFF,
+	0xFF, 0x09, 0x0A, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x0B, 0x0C, 0xFF,
+	0xFF, 0x0D, 0x0E, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+#elif (LINE_CODE == LINE_CODE_HAMMING)
+const uint8_t lc_enc_table[16] PROGMEM = {
+	0x09, 0x8E, 0x90, 0x17, 0xA3, 0x24, 0x3A, 0xBD,
+	0x42, 0xC5, 0xDB, 0x5C, 0xE8, 0x6F, 0x71, 0xF6
+};
+
+const uint8_t lc_dec_table[256] PROGMEM = {
+	0xFF, 0x00, 0x08, 0xFF, 0x05, 0xFF, 0xFF, 0x03,
+	0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0x01, 0xFF,
+	0x02, 0xFF, 0xFF, 0x03, 0xFF, 0x03, 0x03, 0x03,
+	0xFF, 0x00, 0x06, 0xFF, 0x0B, 0xFF, 0xFF, 0x03,
+	0x05, 0xFF, 0xFF, 0x04, 0x05, 0x05, 0x05, 0xFF,
+	0xFF, 0x00, 0x06, 0xFF, 0x05, 0xFF, 0xFF, 0x0D,
+	0xFF, 0x0E, 0x06, 0xFF, 0x05, 0xFF, 0xFF, 0x03,
+	0x06, 0xFF, 0x06, 0x06, 0xFF, 0x07, 0x06, 0xFF,
+	0x08, 0xFF, 0x08, 0x08, 0xFF, 0x09, 0x08, 0xFF,
+	0xFF, 0x00, 0x08, 0xFF, 0x0B, 0xFF, 0xFF, 0x0D,
+	0xFF, 0x0E, 0x08, 0xFF, 0x0B, 0xFF, 0xFF, 0x03,
+	0x0B, 0xFF, 0xFF, 0x0A, 0x0B, 0x0B, 0x0B, 0xFF,
+	0xFF, 0x0E, 0x08, 0xFF, 0x05, 0xFF, 0xFF, 0x0D,
+	0x0C, 0xFF, 0xFF, 0x0D, 0xFF, 0x0D, 0x0D, 0x0D,
+	0x0E, 0x0E, 0xFF, 0x0E, 0xFF, 0x0E, 0x0F, 0xFF,
+	0xFF, 0x0E, 0x06, 0xFF, 0x0B, 0xFF, 0xFF, 0x0D,
+	0x02, 0xFF, 0xFF, 0x04, 0xFF, 0x09, 0x01, 0xFF,
+	0xFF, 0x00, 0x01, 0xFF, 0x01, 0xFF, 0x01, 0x01,
+	0x02, 0x02, 0x02, 0xFF, 0x02, 0xFF, 0xFF, 0x03,
+	0x02, 0xFF, 0xFF, 0x0A, 0xFF, 0x07, 0x01, 0xFF,
+	0xFF, 0x04, 0x04, 0x04, 0x05, 0xFF, 0xFF, 0x04,
+	0x0C, 0xFF, 0xFF, 0x04, 0xFF, 0x07, 0x01, 0xFF,
+	0x02, 0xFF, 0xFF, 0x04, 0xFF, 0x07, 0x0F, 0xFF,
+	0xFF, 0x07, 0x06, 0xFF, 0x07, 0x07, 0xFF, 0x07,
+	0xFF, 0x09, 0x08, 0xFF, 0x09, 0x09, 0xFF, 0x09,
+	0x0C, 0xFF, 0xFF, 0x0A, 0xFF, 0x09, 0x01, 0xFF,
+	0x02, 0xFF, 0xFF, 0x0A, 0xFF, 0x09, 0x0F, 0xFF,
+	0xFF, 0x0A, 0x0A, 0x0A, 0x0B, 0xFF, 0xFF, 0x0A,
+	0x0C, 0xFF, 0xFF, 0x04, 0xFF, 0x09, 0x0F, 0xFF,
+	0x0C, 0x0C, 0x0C, 0xFF, 0x0C, 0xFF, 0xFF, 0x0D,
+	0xFF, 0x0E, 0x0F, 0xFF, 0x0F, 0xFF, 0x0F, 0x0F,
+	0x0C, 0xFF, 0xFF, 0x0A, 0xFF, 0x07, 0x0F, 0xFF
+};
+#endif
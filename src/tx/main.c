@@ -23,118 +23,121 @@
 #include <avr/io.h>
 #include <avr/sleep.h>
 #include <avr/interrupt.h>
-#include <util/delay.h>
-#include <util/atomic.h>
+#include <avr/eeprom.h>
 
 #include "rftx.h"
+#include "keypad.h"
 #include "utils.h"
 
-#define SW_INT_PORT	PORTD
-#define SW_INT_PIN	PD3		// interrupt
-#define SW_INP_PORT	PORTB
-#define SW_PWR_PIN	PB5		// power on/off
-#define SW_INC_PIN	PB4		// increase speed
-#define SW_DEC_PIN	PB3		// decrease speed
-#define TX_GND_PORT	PORTC
-#define TX_GND_PIN	PC5
+#define KEY_BATCH		3	// steps sent as one packet while a key is held
+#define PRESET_LOW		3	// speed of KEY_LOW
+#define PRESET_HIGH		7	// speed of KEY_HIGH
 
-static inline void tx_pwr_on(void) {
-	cbit(TX_GND_PORT, TX_GND_PIN);
-	_delay_ms(50);
-}
-static inline void tx_pwr_off(void) {
-	sbit(TX_GND_PORT, TX_GND_PIN);
-}
-
-ISR(INT1_vect) {
-	/* test if power on/off switch is pressed */
-	cbit(SW_INP_PORT, SW_PWR_PIN);
-	sbit(SW_INP_PORT, SW_INC_PIN);
-	sbit(SW_INP_PORT, SW_DEC_PIN);
-
-	while (bit_is_clr(pin(SW_INT_PORT), SW_INT_PIN)) {
-		cbit(SW_INP_PORT, SW_INC_PIN);
-		cbit(SW_INP_PORT, SW_DEC_PIN);
-
-		tx_pwr_on();
-		tx_putcmd(CMD_PWR);
-		tx_pwr_off();
-	}
-
-	/* test if increment switch is pressed */
-	sbit(SW_INP_PORT, SW_PWR_PIN);
-	cbit(SW_INP_PORT, SW_INC_PIN);
-	sbit(SW_INP_PORT, SW_DEC_PIN);
-
-	while (bit_is_clr(pin(SW_INT_PORT), SW_INT_PIN)) {
-		cbit(SW_INP_PORT, SW_PWR_PIN);
-		cbit(SW_INP_PORT, SW_DEC_PIN);
-
-		tx_pwr_on();
-		tx_putcmd(CMD_INC);
-		tx_pwr_off();
-	}
-
-	/* test if decrement switch is pressed */
-	sbit(SW_INP_PORT, SW_PWR_PIN);
-	sbit(SW_INP_PORT, SW_INC_PIN);
-	cbit(SW_INP_PORT, SW_DEC_PIN);
-
-	while (bit_is_clr(pin(SW_INT_PORT), SW_INT_PIN)) {
-		cbit(SW_INP_PORT, SW_PWR_PIN);
-		cbit(SW_INP_PORT, SW_INC_PIN);
-
-		tx_pwr_on();
-		tx_putcmd(CMD_DEC);
-		tx_pwr_off();
-	}
-
-	/* restore states */
-	cbit(SW_INP_PORT, SW_PWR_PIN);
-	cbit(SW_INP_PORT, SW_INC_PIN);
-	cbit(SW_INP_PORT, SW_DEC_PIN);
-}
+#if (PRESET_LOW > SPEED_MAX || PRESET_HIGH > SPEED_MAX)
+#error "speed presets above SPEED_MAX"
+#endif
 
 int main(void) {
+	uint8_t ev;
+	uint8_t key;
+	uint8_t repeated = 0;	// steps of speed came from repeats
+	uint8_t pair = 0;		// CMD_PAIR is still to be sent
+	uint8_t steps = 0;		// INC and DEC steps since speed was last sent
+	uint8_t power, speed;	// desired state, as last sent
+	uint8_t cmd = 0;		// any other command still to be sent
+	uint8_t data[2];		// its payload
+	uint8_t len = 0;
+
 	/* initialize transmitter */
 	rftx_init();
 
-	/* setup external interrupts */
-	cbit(ddr(SW_INT_PORT), SW_INT_PIN);
-	// input
-	sbit(ddr(SW_INP_PORT), SW_PWR_PIN);
-	// output
-	sbit(ddr(SW_INP_PORT), SW_INC_PIN);
-	// output
-	sbit(ddr(SW_INP_PORT), SW_DEC_PIN);
-	// output
-	sbit(ddr(TX_GND_PORT), TX_GND_PIN);
-	// output
-
-	sbit(SW_INT_PORT, SW_INT_PIN);
-	// enable pullup
-	cbit(SW_INP_PORT, SW_PWR_PIN);
-	// disable pullup
-	cbit(SW_INP_PORT, SW_INC_PIN);
-	// disable pullup
-	cbit(SW_INP_PORT, SW_DEC_PIN);
-	// disable pullup
-
-	sbit(GIMSK, INT1);
-	// set interrupt mask
-	tx_pwr_off();						// power off tx for now
+	/* the receiver is told absolute values, pick up where we left off */
+	power = eeprom_read_byte(EE_POWER) == 1;
+	speed = eeprom_read_byte(EE_SPEED);
+	if (speed > SPEED_MAX) {
+		speed = 0;
+	}
 
-	/* enable power saving features */
-	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
-	sleep_enable()
-	;
+	/* keys wake the CPU through the external interrupts */
+	key_init();
 
 	/* enable interrupts globally */sei();
 
 	while (1) {
-		/* enter sleep mode */
-		sleep_cpu()
-		;
+		/* every key is sent as the power or speed it asks for, never as a
+		 * change, so a repeat does no harm and the next press repairs a
+		 * lost one. Power and speed go out separately, a remote whose copy
+		 * went stale while another one was used only overrides the half
+		 * its key is about. A key that needs a packet of its own is left
+		 * queued until the one before it has gone out. */
+		while (!cmd && key_pending()) {
+			ev = key_event();
+			key = key_code(ev);
+			if (key_type(ev) == KEY_PRESS || key_type(ev) == KEY_REPEAT) {
+				if (key == KEY_INC && speed != SPEED_MAX) {
+					++speed;
+				} else if (key == KEY_DEC && speed != 0) {
+					--speed;
+				}
+				if (key == KEY_INC || key == KEY_DEC) {
+					++steps;
+					repeated = key_type(ev) == KEY_REPEAT;
+				} else if (key == KEY_PWR || key == KEY_OFF) {
+					power = key == KEY_PWR ? !power : 0;
+					cmd = CMD_PWR;
+					data[0] = power;
+					len = 1;
+				} else {
+					power = 1;
+					speed = key == KEY_LOW ? PRESET_LOW : PRESET_HIGH;
+					cmd = CMD_STATE;
+					data[0] = power;
+					data[1] = speed;
+					len = 2;
+				}
+			} else if (key_type(ev) == KEY_HOLD && key == KEY_PWR) {
+				pair = 1;
+			}
+		}
+
+		/* the first step of a press goes out at once, repeats are sent as
+		 * one speed once the key is released or enough of them have piled
+		 * up, speed steps go before a command that came after them, a held
+		 * power key toggles once and then asks to pair */
+		if (steps && !tx_busy() && (cmd || !key_down() || !repeated || steps >= KEY_BATCH)) {
+			tx_putpacket(CMD_SPEED, &speed, 1);
+			steps = 0;
+		}
+		if (cmd && !steps && !tx_busy()) {
+			tx_putpacket(cmd, data, len);
+			cmd = 0;
+		}
+		if (pair && !cmd && !tx_busy()) {
+			tx_putcmd(CMD_PAIR);
+			pair = 0;
+		}
+
+		/* the UART and timers need the I/O clock while keys are scanned or
+		 * a packet is on its way or the RF module is held powered, otherwise
+		 * wait for a key in power-down */
+		cli();
+		if (!cmd && key_pending()) {
+			sei();
+			continue;
+		}
+		if (steps || cmd || pair || key_active() || tx_powered()) {
+			set_sleep_mode(SLEEP_MODE_IDLE);
+		} else {
+			/* only bytes that changed are written, the write finishes
+			 * while the CPU sleeps */
+			eeprom_update_byte(EE_POWER, power);
+			eeprom_update_byte(EE_SPEED, speed);
+			set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+		}
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
 	}
 	return 0;
 }
@@ -21,69 +21,306 @@
  */
 
 #include <avr/io.h>
-#include <util/delay.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
 #include <util/atomic.h>
 
 #include "rftx.h"
+#include "uart.h"
+#include "crc8.h"
+#include "linecode.h"
+#include "auth.h"
 #include "utils.h"
 
-static void tx_putc(uint8_t data) {
-	/* wait until buffer is empty */
-	while (!(UCSRA & (1 << UDRE)))
-		;
+#define TX_GND_PORT	PORTC
+#define TX_GND_PIN	PC5		// RF module ground, active low
 
-	/* write data to buffer */UDR = data;
+/* settle, gap and hold times are counted by timer 0 at clk/1024 */
+#define MS_TO_TICKS(ms)	(((ms) * (F_CPU / 1000UL) + 1023) / 1024)
 
-	/* wait until entire frame is shifted out */
-	while (!(UCSRA & (1 << TXC)))
-		;
+#if (MS_TO_TICKS(TX_SETTLE_MS) > 255)
+#error "TX_SETTLE_MS too long for timer 0"
+#endif
+
+#if (MS_TO_TICKS(TX_GAP_MS) > 255)
+#error "TX_GAP_MS too long for timer 0"
+#endif
+
+#if (MS_TO_TICKS(TX_HOLD_MS) > 255)
+#error "TX_HOLD_MS too long for timer 0"
+#endif
+
+/* bytes one copy takes in the UART ring buffer, HEAD and SIGN go out as
+ * they are. tx_copy() runs from the interrupts and queues a whole copy
+ * into the empty ring, uart_putc() would spin there for good if it did not
+ * fit. The preamble is queued on its own before, see tx_next(). */
+#if (LINE_CODE != LINE_CODE_NONE)
+#define TX_COPY_BYTES	(2 + 2 * (PACKET_DATA_MAX + 6 + AUTH_MAC_SIZE))
+#else
+#define TX_COPY_BYTES	(PACKET_DATA_MAX + 8 + AUTH_MAC_SIZE)
+#endif
+
+#if (TX_COPY_BYTES > uart_tx_buffer_size - 1)
+#error "a packet copy does not fit uart_tx_buffer_size"
+#endif
+
+#if (TX_PREAMBLE > uart_tx_buffer_size - 1)
+#error "TX_PREAMBLE does not fit uart_tx_buffer_size"
+#endif
+
+/* sequence numbers are handed out in blocks, the end of the current block
+ * is kept in EEPROM so numbers never go backwards across a battery change */
+#define TX_SEQ_BLOCK	0x40
+
+static uint8_t packet[PACKET_DATA_MAX + 8 + AUTH_MAC_SIZE];
+static uint8_t packet_size;			// bytes in front of the checksum
+static uint16_t tx_id;
+#if (AUTH != AUTH_NONE)
+static uint32_t tx_seq;				// rolling counter, the low byte goes on air
+static uint32_t tx_seq_end;
+static const uint8_t tx_key_default[16] PROGMEM = AUTH_KEY;
+#else
+static uint8_t tx_seq;
+static uint8_t tx_seq_end;			// first number of the next block
+#endif
+static uint8_t tx_preamble;			// sync bytes in front of the first copy
+static uint8_t tx_repeat;			// copies of each packet
+static uint8_t tx_gap;				// timer 0 ticks between copies
+static uint8_t tx_settle;			// timer 0 ticks from power-up to the first byte
+static uint8_t tx_hold;				// timer 0 ticks the module stays powered
+static volatile uint8_t tx_left;	// copies still to be queued
+static volatile uint8_t tx_synced;	// preamble has been queued
+static volatile uint8_t tx_active;
+static volatile uint8_t tx_rf;		// RF module is powered
+
+static inline void tx_pwr_on(void) {
+	cbit(TX_GND_PORT, TX_GND_PIN);
+	tx_rf = 1;
 }
 
-void rftx_init(void) {
-	/* set baud rate */
-	UBRRL = (uint8_t) (UBRRVAL);
-	UBRRH = (uint8_t) (UBRRVAL >> 8);
+static inline void tx_pwr_off(void) {
+	sbit(TX_GND_PORT, TX_GND_PIN);
+	tx_rf = 0;
+}
+
+/* count timer 0 ticks, its overflow interrupt takes the next step */
+static inline void tx_timer(uint8_t ticks) {
+	TCNT0 = 256 - ticks;
+	TCCR0 = (1 << CS02) | (1 << CS00);	// clk/1024
+}
 
-	/* enable transmitter only */UCSRB = (1 << TXEN);
+/* queue one copy of the packet to the UART ring buffer */
+static void tx_copy(void) {
+	uint8_t i;
 
-	/* set frame format: asynchronous mode, 8-bit data, no parity, 1 stop bit  */
-	UCSRC = (1 << URSEL) | (3 << UCSZ0);
+	uart_putc(packet[0]);
+	uart_putc(packet[1]);
+	for (i = 2; i <= packet_size; ++i) {
+#if (LINE_CODE != LINE_CODE_NONE)
+		uart_putc(lc_encode(packet[i] >> 4));
+		uart_putc(lc_encode(packet[i] & 0x0F));
+#else
+		uart_putc(packet[i]);
+#endif
+	}
+	--tx_left;
 }
 
-void tx_putcmd(uint8_t data) {
+/* preamble first, then one copy, the rest follows from the interrupts */
+static void tx_next(void) {
 	uint8_t i;
-	uint8_t packet[4];
 
-	/* atomic transaction to prevent interrupts from interfering */
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		packet[0] = PACKET_HEAD;
-		packet[1] = PACKET_SIGN;
-		packet[2] = data;
-		packet[3] = 0x00;
-		switch (data) {
-		case CMD_PWR:
-			packet[3] = CRC_CMD_PWR;
-			break;
-		case CMD_INC:
-			packet[3] = CRC_CMD_INC;
-			break;
-		case CMD_DEC:
-			packet[3] = CRC_CMD_DEC;
-			break;
+	if (!tx_synced) {
+		tx_synced = 1;
+		if (tx_preamble) {
+			/* attempt to synchronize, the first copy follows from the
+			 * transmit complete interrupt */
+			for (i = 0; i < tx_preamble; ++i) {
+				uart_putc(LC_SYNC);
+			}
+			return;
+		}
+	}
+	tx_copy();
+}
+
+/* RF module has settled, the gap between copies or the hold is over */
+ISR(TIMER0_OVF_vect) {
+	TCCR0 = 0;	// stop timer
+
+	if (tx_active) {
+		tx_next();
+	} else {
+		tx_pwr_off();
+	}
+}
+
+/* shift register ran empty, queue the next copy or power down */
+ISR(USART_TXC_vect) {
+	if (uart_tx_pending()) {
+		return;
+	}
+
+	if (tx_left) {
+		if (tx_gap && tx_left != tx_repeat) {
+			tx_timer(tx_gap);
+		} else {
+			tx_copy();
+		}
+	} else {
+		tx_active = 0;
+		if (tx_hold) {
+			tx_timer(tx_hold);	// another packet may follow soon
+		} else {
+			tx_pwr_off();
 		}
+	}
+}
+
+void rftx_init(void) {
+	uint32_t gap;
+#if (AUTH != AUTH_NONE)
+	uint8_t key[16];
+	uint8_t erased = 0xFF;
+	uint8_t i;
+#endif
+
+	uart_init(UART_2X ? (UBRRVAL | 0x8000) : UBRRVAL);	// bit 15 selects U2X
 
-		tx_putc(0xFF);	// attempt to synchronize
+	/* transmitter only, the transmit complete interrupt powers the RF
+	 * module down once the ring buffer has drained */
+	UCSRB = (1 << TXCIE) | (1 << TXEN);
 
-		for (i = 0; i < 2; ++i) {
-			tx_putc(packet[0]);
-			tx_putc(packet[1]);
-			tx_putc(packet[2]);
-			tx_putc(0xFF);
+	sbit(ddr(TX_GND_PORT), TX_GND_PIN);	// output
+	tx_pwr_off();						// power off tx for now
+
+	TIMSK |= (1 << TOIE0);
+
+	tx_preamble = eeprom_read_byte(EE_PREAMBLE);
+	if (tx_preamble == 0xFF) {
+		tx_preamble = TX_PREAMBLE;
+	}
+	if (tx_preamble > uart_tx_buffer_size - 1) {
+		tx_preamble = uart_tx_buffer_size - 1;	// must fit the ring buffer
+	}
+	tx_repeat = eeprom_read_byte(EE_REPEAT);
+	if (tx_repeat == 0xFF || tx_repeat == 0) {
+		tx_repeat = TX_REPEAT;
+	}
+	gap = eeprom_read_byte(EE_GAP);
+	gap = MS_TO_TICKS(gap == 0xFF ? TX_GAP_MS : gap);
+	tx_gap = gap > 255 ? 255 : gap;
+	gap = eeprom_read_byte(EE_SETTLE);
+	gap = MS_TO_TICKS(gap == 0xFF ? TX_SETTLE_MS : gap);
+	tx_settle = gap > 255 ? 255 : gap;
+	gap = eeprom_read_byte(EE_HOLD);
+	gap = MS_TO_TICKS(gap == 0xFF ? TX_HOLD_MS : gap);
+	tx_hold = gap > 255 ? 255 : gap;
+
+	tx_id = eeprom_read_word(EE_ID);
+	if (tx_id == 0xFFFF) {
+		tx_id = TX_ID;
+	}
+
+#if (AUTH != AUTH_NONE)
+	eeprom_read_block(key, EE_KEY, sizeof(key));
+	for (i = 0; i < sizeof(key); ++i) {
+		erased &= key[i];
+	}
+	if (erased == 0xFF) {
+		memcpy_P(key, tx_key_default, sizeof(key));
+	}
+	auth_init(key);
+
+	eeprom_read_block(&tx_seq, EE_CTR, sizeof(tx_seq));
+	if (tx_seq == 0xFFFFFFFF) {
+		tx_seq = 0;
+	}
+#else
+	tx_seq = eeprom_read_byte(EE_SEQ);
+#endif
+	tx_seq_end = tx_seq;	// reserved with the first packet
+}
+
+uint8_t tx_busy(void) {
+	return tx_active;
+}
+
+uint8_t tx_powered(void) {
+	return tx_rf;
+}
+
+void tx_putcmd(uint8_t cmd) {
+	tx_putpacket(cmd, 0, 0);
+}
+
+void tx_putpacket(uint8_t cmd, const uint8_t *data, uint8_t len) {
+	uint8_t i;
+#if (AUTH != AUTH_NONE)
+	uint8_t ctr[4];
+#endif
+
+	if (tx_active) {
+		return;
+	}
+
+	if (len > PACKET_DATA_MAX) {
+		len = PACKET_DATA_MAX;
+	}
+
+#if (AUTH != AUTH_NONE)
+	/* the whole counter lets the receiver resync */
+	if (cmd == CMD_PAIR) {
+		for (i = 0; i < 4; ++i) {
+			ctr[i] = tx_seq >> (8 * i);
 		}
+		data = ctr;
+		len = 4;
+	}
+#endif
+
+	packet[0] = PACKET_HEAD;
+	packet[1] = PACKET_SIGN;
+	packet[2] = tx_id >> 8;
+	packet[3] = tx_id & 0xFF;
+	packet[4] = len + 1;	// command and payload
+	if (tx_seq == tx_seq_end) {
+		tx_seq_end += TX_SEQ_BLOCK;
+#if (AUTH != AUTH_NONE)
+		eeprom_update_block(&tx_seq_end, EE_CTR, sizeof(tx_seq_end));
+#else
+		eeprom_write_byte(EE_SEQ, tx_seq_end);
+#endif
+	}
+	packet[5] = tx_seq;
+	packet[6] = cmd;
+	for (i = 0; i < len; ++i) {
+		packet[7 + i] = data[i];
+	}
+	packet_size = 7 + len;
+#if (AUTH != AUTH_NONE)
+	auth_mac(&packet[packet_size], tx_seq, &packet[2], packet_size - 2);
+	packet_size += AUTH_MAC_SIZE;
+#endif
+	packet[packet_size] = crc8(packet, packet_size);	// checksum over everything before
+	++tx_seq;
 
-		tx_putc(packet[0]);
-		tx_putc(packet[1]);
-		tx_putc(packet[2]);
-		tx_putc(packet[3]);
+	/* power up the RF module and let timer 0 tell when it has settled, a
+	 * module still powered from the last packet is ready at once. The hold
+	 * timer must not see tx_active before it is stopped. */
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		TCCR0 = 0;
+		TIFR = (1 << TOV0);	// the hold may just have run out
+		tx_left = tx_repeat;
+		tx_synced = 0;
+		tx_active = 1;
+		if (tx_rf || !tx_settle) {
+			tx_pwr_on();
+			tx_next();
+		} else {
+			tx_pwr_on();
+			tx_timer(tx_settle);
+		}
 	}
 }
@@ -23,19 +23,97 @@
 #ifndef RFTX_H_
 #define RFTX_H_
 
-#define BAUDRATE			2400
-#define UBRRVAL				((F_CPU/(BAUDRATE*16UL))-1)
+#ifndef BAUDRATE
+#define BAUDRATE		4800
+#endif
+#ifndef UART_2X
+#define UART_2X			1	// double speed, needed above 2400 baud at 1 MHz
+#endif
+
+#if UART_2X
+#define UBRR_DIV		8UL
+#define BAUD_TOL		15	// receiver tolerance in permille, 8N1 at double speed
+#else
+#define UBRR_DIV		16UL
+#define BAUD_TOL		20	// receiver tolerance in permille, 8N1
+#endif
+#define UBRRVAL			((F_CPU+BAUDRATE*UBRR_DIV/2)/(BAUDRATE*UBRR_DIV)-1)
+#define BAUD_REAL		(F_CPU/(UBRR_DIV*(UBRRVAL+1)))
+
+#if ((BAUD_REAL*1000 > BAUDRATE*(1000UL+BAUD_TOL)) || (BAUD_REAL*1000 < BAUDRATE*(1000UL-BAUD_TOL)))
+#error "BAUDRATE cannot be generated from F_CPU within the UART tolerance"
+#endif
 
 #define PACKET_HEAD	0xAA	// header
 #define PACKET_SIGN	0x2E	// signature
-#define CMD_PWR		0x01	// toggle power on/off
+#define PACKET_DATA_MAX	4	// maximum payload bytes following the command
+#define CMD_PWR		0x01	// toggle power, or set it from an optional payload byte
 #define CMD_INC		0x02	// increment speed
 #define CMD_DEC		0x03	// decrement speed
-#define CRC_CMD_PWR	0xDF
-#define CRC_CMD_INC	0x3D
-#define CRC_CMD_DEC	0x63
+#define CMD_DELTA	0x04	// change speed by a signed amount, one payload byte
+#define CMD_SPEED	0x05	// set absolute speed, one payload byte
+#define CMD_STATE	0x06	// set power and speed, two payload bytes
+#define CMD_PAIR	0x07	// pair with receivers that have pairing open
+#define SPEED_MAX	9
+
+/* EEPROM map, erased bytes select the compile time defaults so the
+ * transmit profile can be patched with avrdude */
+#define EE_PREAMBLE	((uint8_t *) 0)	// transmit profile
+#define EE_REPEAT	((uint8_t *) 1)
+#define EE_GAP		((uint8_t *) 2)
+#define EE_SEQ		((uint8_t *) 3)	// end of the reserved sequence block
+#define EE_POWER	((uint8_t *) 4)	// last state sent
+#define EE_SPEED	((uint8_t *) 5)
+#define EE_ID		((uint16_t *) 6)	// address of this remote, little endian
+#define EE_KEY		((uint8_t *) 8)		// 16 bytes, AUTH_SPECK only
+#define EE_CTR		((uint32_t *) 24)	// end of the reserved counter block, AUTH_SPECK only
+#define EE_SETTLE	((uint8_t *) 28)	// transmit profile, continued
+#define EE_HOLD		((uint8_t *) 29)
+
+/* default transmit profile, each value can be overridden from EEPROM */
+#ifndef TX_PREAMBLE
+#define TX_PREAMBLE	1		// 0xFF bytes in front of the first copy
+#endif
+#ifndef TX_REPEAT
+#define TX_REPEAT	2		// copies of each packet, 3 or more if the receiver has RX_VOTE
+#endif
+#ifndef TX_GAP_MS
+#define TX_GAP_MS	0		// silence between copies
+#endif
+#ifndef TX_SETTLE_MS
+#define TX_SETTLE_MS	3	// RF module power-up to the first byte
+#endif
+#ifndef TX_HOLD_MS
+#define TX_HOLD_MS	0		// RF module stays powered after a packet
+#endif
+
+/* address used when EE_ID is erased, give every remote its own one
+ * either here or in EEPROM, 0xFFFF is reserved */
+#ifndef TX_ID
+#define TX_ID		0x0001
+#endif
+
+#if (TX_ID == 0xFFFF)
+#error "TX_ID 0xFFFF marks an empty pairing slot"
+#endif
 
 void rftx_init(void);
-void tx_putcmd(uint8_t data);
+
+/*
+ * Packets are sent in the background: the RF module is powered up, the
+ * packet is queued once it has settled and the module is powered down
+ * again TX_HOLD_MS after the transmit complete interrupt. A packet handed
+ * over within that time goes out at once without settling again, one
+ * handed over while tx_busy() is still true is dropped. Timer 0 needs the
+ * I/O clock as long as tx_powered() is true.
+ *
+ * Every copy of a packet carries the address of the remote, the same
+ * sequence number and a valid checksum, the receiver acts on the first
+ * one that gets through.
+ */
+uint8_t tx_busy(void);
+uint8_t tx_powered(void);
+void tx_putcmd(uint8_t cmd);
+void tx_putpacket(uint8_t cmd, const uint8_t *data, uint8_t len);
 
 #endif /* RFTX_H_ */
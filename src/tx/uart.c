@@ -132,6 +132,10 @@ void uart_putc(unsigned char data) {
 	uart_control |= _BV(uart_udrie);
 }
 
+unsigned char uart_tx_pending(void) {
+	return uart_tx_head != uart_tx_tail;
+}
+
 void uart_puts(const char *s) {
 	while (*s) {
 		uart_putc(*s++);
@@ -47,7 +47,7 @@
 #endif
 /** Size of the circular transmit buffer, must be power of 2 */
 #ifndef uart_tx_buffer_size
-#define uart_tx_buffer_size	16
+#define uart_tx_buffer_size	32
 #endif
 
 /* test if the size of the circular buffers fits into SRAM */
@@ -108,6 +108,13 @@ extern unsigned int uart_getc(void);
  */
 extern void uart_putc(unsigned char data);
 
+/**
+ *  @brief   Test if the transmit ringbuffer still holds data
+ *  @param   void
+ *  @return  non-zero while bytes are waiting to be transmitted
+ */
+extern unsigned char uart_tx_pending(void);
+
 /**
  *  @brief   Put string to ringbuffer for transmitting via UART
  *
@@ -0,0 +1,427 @@
+/*
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * wcet.c
+ *
+ * wcet - runs the transmitter and receiver images under simavr and counts
+ * the cycles every interrupt handler takes. The transmitter is keyed
+ * first, whatever it sends is then played to the receiver with garbage in
+ * the pauses. Reports the cycles per handler entry, the time spent with
+ * interrupts disabled and what is left of a byte at other baud rates.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_io.h>
+#include <simavr/sim_irq.h>
+#include <simavr/sim_interrupts.h>
+#include <simavr/avr_uart.h>
+#include <simavr/avr_ioport.h>
+
+#define VECTORS			19			// ATmega8, reset included
+#define NEST_MAX		8
+#define CAPTURE_MAX		8192
+
+/* I/O registers in the data space, ATmega8 */
+#define D_UBRRL			0x29
+#define D_UCSRB			0x2A
+#define D_UCSRA			0x2B
+#define D_DDRB			0x37
+#define D_PORTB			0x38
+#define RXEN			4
+#define U2X				1
+
+/* wiring, see src/tx/keypad.c and src/rx/rfrx.h */
+#define TX_KEY_PWR		(1 << 5)	// PB5
+#define TX_KEY_INC		(1 << 4)	// PB4
+#define TX_KEY_DEC		(1 << 3)	// PB3
+#define PAIR_HOLD_MS	3000		// KEY_HOLD_MS in src/tx/keypad.h
+
+#define VEC_TIMER1_CAPT	5
+#define VEC_USART_RXC	11
+#define VEC_USART_UDRE	12
+
+#define ms(x)			((uint64_t) ((x) * (F_CPU / 1000.0)))
+
+static const char *const vector_name[VECTORS] = {
+	"RESET", "INT0", "INT1", "TIMER2_COMP", "TIMER2_OVF", "TIMER1_CAPT",
+	"TIMER1_COMPA", "TIMER1_COMPB", "TIMER1_OVF", "TIMER0_OVF", "SPI_STC",
+	"USART_RXC", "USART_UDRE", "USART_TXC", "ADC", "EE_RDY", "ANA_COMP",
+	"TWI", "SPM_RDY"
+};
+
+/* baud rates the headroom is worked out for */
+static const unsigned long bauds[] = { 2400, 4800, 9600, 19200, 38400, 57600 };
+
+struct vector {
+	unsigned long n;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+};
+
+static avr_t *avr;
+static struct vector vec[VECTORS];
+static struct {
+	uint8_t v;
+	uint64_t start;
+} nest[NEST_MAX];				// handlers running, innermost last
+static unsigned nest_n;
+static uint8_t byte_vec;		// the handler every byte on the link takes
+static uint8_t byte_bits;		// it has to be done within, 1 for every edge
+static uint64_t off_total;		// cycles with interrupts disabled
+static uint64_t off_since;		// start of the current stretch, 0 if enabled
+static uint64_t off_max;		// longest stretch outside byte_vec
+static uint8_t off_in_byte;		// current stretch started in byte_vec
+static uint64_t started;
+static uint64_t wake_at;		// run_until() target, a sleep must not pass it
+
+static struct {
+	uint8_t data;
+	uint64_t when;
+} capture[CAPTURE_MAX];			// bytes the transmitter sent
+static unsigned capture_n;
+static double bit;				// UART bit of the transmitter in cycles
+
+static avr_irq_t *row_irq;		// keypad row 1, PD3
+static uint8_t row_level = 1;
+static uint8_t key_cols;		// columns of the keys held down
+
+static int verbose;
+
+static void isr_running(struct avr_irq_t *irq, uint32_t value, void *param) {
+	uint8_t v = (uintptr_t) param;
+	uint64_t t;
+
+	(void) irq;
+	if (value) {
+		if (nest_n < NEST_MAX) {
+			nest[nest_n].v = v;
+			nest[nest_n].start = avr->cycle;
+		}
+		++nest_n;
+		return;
+	}
+	if (nest_n == 0 || --nest_n >= NEST_MAX || nest[nest_n].v != v) {
+		return;
+	}
+	t = avr->cycle - nest[nest_n].start;	// nested handlers are part of it
+	if (!vec[v].n || t < vec[v].min) {
+		vec[v].min = t;
+	}
+	if (t > vec[v].max) {
+		vec[v].max = t;
+	}
+	vec[v].sum += t;
+	++vec[v].n;
+}
+
+/* simavr skips a sleeping core ahead to its next timer event, which can
+ * be a whole timer 0 overflow away. Stop at the next pin change instead,
+ * or edges on the data line would come late. */
+static void sleep_until(avr_t *a, avr_cycle_count_t howlong) {
+	uint64_t to = a->cycle + 1 + howlong;
+
+	if (to > wake_at) {
+		to = wake_at > a->cycle ? wake_at : a->cycle + 1;
+	}
+	a->cycle = to;
+}
+
+static void board_load(const char *elf) {
+	elf_firmware_t fw;
+	uint32_t flags = 0;
+	uintptr_t v;
+
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(elf, &fw)) {
+		fprintf(stderr, "wcet: cannot read %s\n", elf);
+		exit(1);
+	}
+	strcpy(fw.mmcu, "atmega8");
+	fw.frequency = F_CPU;
+	avr = avr_make_mcu_by_name(fw.mmcu);
+	if (!avr) {
+		fprintf(stderr, "wcet: simavr has no %s\n", fw.mmcu);
+		exit(1);
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->sleep = sleep_until;
+
+	/* bytes on TXD stay with the harness */
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+	for (v = 1; v < VECTORS; ++v) {
+		avr_irq_t *irq = avr_get_interrupt_irq(avr, v);
+
+		if (irq) {
+			avr_irq_register_notify(irq + AVR_INT_IRQ_RUNNING, isr_running,
+					(void *) v);
+		}
+	}
+	memset(vec, 0, sizeof(vec));
+	nest_n = 0;
+	off_total = 0;
+	off_since = 0;
+	off_max = 0;
+	started = avr->cycle;
+}
+
+static void pin_set(char port, int pin, uint8_t level) {
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), pin), level);
+}
+
+/* a row reads low while one of the keys on it has its column driven low */
+static void keys_step(void) {
+	uint8_t low = key_cols & avr->data[D_DDRB] & ~avr->data[D_PORTB];
+	uint8_t level = !low;
+
+	if (row_irq && level != row_level) {
+		row_level = level;
+		avr_raise_irq(row_irq, level);
+	}
+}
+
+/* one instruction at a time, so every cycle with the I flag clear is seen */
+static void run_until(uint64_t until) {
+	wake_at = until;
+	while (avr->cycle < until) {
+		uint64_t before = avr->cycle;
+		uint8_t enabled = avr->sreg[S_I];
+		int state;
+
+		if (enabled && off_since) {
+			off_total += before - off_since;
+			if (!off_in_byte && before - off_since > off_max) {
+				off_max = before - off_since;
+			}
+			off_since = 0;
+		} else if (!enabled && !off_since) {
+			off_since = before;
+			off_in_byte = nest_n && nest_n <= NEST_MAX
+					&& nest[nest_n - 1].v == byte_vec;
+		}
+		state = avr_run(avr);
+		if (state == cpu_Done || state == cpu_Crashed) {
+			fprintf(stderr, "wcet: firmware stopped at %llu cycles\n",
+					(unsigned long long) avr->cycle);
+			exit(1);
+		}
+		keys_step();
+	}
+}
+
+/* UART bit the firmware set up, in cycles, UBRRH shares its address with
+ * UCSRC and stays 0 at 1 MHz */
+static double uart_bit(void) {
+	unsigned ubrr = avr->data[D_UBRRL];
+
+	return (avr->data[D_UCSRA] & (1 << U2X) ? 8.0 : 16.0) * (ubrr + 1);
+}
+
+static void tx_out(struct avr_irq_t *irq, uint32_t value, void *param) {
+	(void) irq;
+	(void) param;
+	if (capture_n < CAPTURE_MAX) {
+		capture[capture_n].data = value;
+		capture[capture_n].when = avr->cycle;
+		++capture_n;
+	}
+}
+
+static void press(uint8_t cols, double hold, double pause) {
+	key_cols = cols;
+	run_until(avr->cycle + ms(hold));
+	key_cols = 0;
+	run_until(avr->cycle + ms(pause));
+}
+
+static void report(const char *name, const char *elf, const char *what) {
+	double elapsed = avr->cycle - started;
+	uint64_t worst = vec[byte_vec].max + off_max;
+	unsigned i;
+
+	printf("%s: %s at %.0f baud, %.2f s\n", name, elf, F_CPU / bit,
+			elapsed / F_CPU);
+	printf("  %-13s %8s %6s %6s %8s\n", "vector", "entries", "min", "max",
+			"mean");
+	for (i = 1; i < VECTORS; ++i) {
+		if (vec[i].n) {
+			printf("  %-13s %8lu %6llu %6llu %8.1f\n", vector_name[i], vec[i].n,
+					(unsigned long long) vec[i].min,
+					(unsigned long long) vec[i].max,
+					(double) vec[i].sum / vec[i].n);
+		}
+	}
+	printf("  interrupts disabled %.2f%% of the time, longest %llu cycles "
+			"outside %s\n", 100.0 * off_total / elapsed,
+			(unsigned long long) off_max, vector_name[byte_vec]);
+	printf("  headroom per %s, %s takes up to %llu cycles after waiting "
+			"%llu:\n", byte_bits == 1 ? "bit" : "byte", what,
+			(unsigned long long) vec[byte_vec].max,
+			(unsigned long long) off_max);
+	for (i = 0; i < sizeof(bauds) / sizeof(bauds[0]); ++i) {
+		double byte = (double) byte_bits * F_CPU / bauds[i];
+
+		printf("  %8lu baud %7.0f cycles, %7.0f left (%5.1f%%)\n", bauds[i],
+				byte, byte - worst, 100.0 * (byte - worst) / byte);
+	}
+	printf("\n");
+}
+
+/* pair, a few presses on every key and a held one that repeats */
+static void run_tx(const char *elf) {
+	static const uint8_t cols[3] = { TX_KEY_PWR, TX_KEY_INC, TX_KEY_DEC };
+	int i;
+
+	board_load(elf);
+	byte_vec = VEC_USART_UDRE;
+	byte_bits = 10;
+	row_irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 3);
+	row_level = 1;
+	key_cols = 0;
+	pin_set('D', 3, 1);	// rows idle high on their pullups
+	pin_set('D', 2, 1);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'),
+			UART_IRQ_OUTPUT), tx_out, 0);
+	capture_n = 0;
+
+	run_until(ms(100));
+	bit = uart_bit();
+	press(TX_KEY_PWR, PAIR_HOLD_MS + 500, 500);
+	for (i = 0; i < 12; ++i) {
+		press(cols[i % 3], 50, 400);
+	}
+	press(TX_KEY_INC, 2000, 500);
+	report("transmitter", elf, "the UDRE refill");
+	row_irq = 0;
+	avr_terminate(avr);
+}
+
+/* a byte on the data line into the input capture, start bit to stop bit */
+static void icp_byte(uint8_t data, uint64_t start) {
+	int i;
+
+	for (i = 0; i < 10; ++i) {
+		uint8_t level = i == 0 ? 0 : (i == 9 ? 1 : (data >> (i - 1)) & 1);
+
+		run_until(start + (uint64_t) (i * bit));
+		pin_set('B', 0, level);
+	}
+}
+
+/* whatever the transmitter sent, paced at its baud rate, with bursts of
+ * garbage in half of the pauses and a long deferred save at the end */
+static void run_rx(const char *elf) {
+	avr_irq_t *rxd;
+	uint64_t t0, t;
+	uint8_t icp;
+	unsigned i, j;
+
+	board_load(elf);
+	pin_set('D', 7, 1);	// no telemetry jumper
+	pin_set('D', 2, 0);	// zero-cross detector idles low
+	pin_set('B', 0, 1);	// data line idles at mark
+	rxd = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+
+	run_until(ms(100));
+	icp = !(avr->data[D_UCSRB] & (1 << RXEN));
+	byte_vec = icp ? VEC_TIMER1_CAPT : VEC_USART_RXC;
+	byte_bits = icp ? 1 : 10;	// an edge can follow the last one a bit later
+
+	t0 = t = avr->cycle;
+	for (i = 0; i < capture_n; ++i) {
+		uint64_t when = t0 + capture[i].when - capture[0].when;
+
+		if (when > t + 20 * bit && random() & 1) {
+			unsigned n = 1 + random() % 8;
+
+			for (j = 0; j < n; ++j) {
+				uint8_t garbage = random();
+
+				if (icp) {
+					icp_byte(garbage, t);
+				} else {
+					run_until(t);
+					avr_raise_irq(rxd, garbage);
+				}
+				t += (uint64_t) (10 * bit);
+			}
+		}
+		if (when < t) {
+			when = t;
+		}
+		if (icp) {
+			icp_byte(capture[i].data, when);
+		} else {
+			run_until(when);
+			avr_raise_irq(rxd, capture[i].data);
+		}
+		t = when + (uint64_t) (10 * bit);
+	}
+	run_until(t + ms(3500));
+	if (!vec[byte_vec].n) {
+		fprintf(stderr, "wcet: %s never ran, does simavr model it on the "
+				"atmega8?\n", vector_name[byte_vec]);
+		exit(1);
+	}
+	report("receiver", elf, icp ? "the input capture" : "the receive interrupt");
+	avr_terminate(avr);
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: wcet [-r seed] [-v] rx.elf tx.elf\n");
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	unsigned long seed = 1;
+	int c;
+
+	while ((c = getopt(argc, argv, "r:v")) != -1) {
+		switch (c) {
+		case 'r':
+			seed = strtoul(optarg, 0, 0);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind != 2) {
+		usage();
+	}
+	srandom(seed);
+
+	run_tx(argv[optind + 1]);
+	if (verbose) {
+		printf("%u bytes sent\n\n", capture_n);
+	}
+	run_rx(argv[optind]);
+
+	return 0;
+}